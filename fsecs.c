@@ -8,6 +8,9 @@
 #include "ftimer.h"
 #include "config.h"
 
+#define CLOCK_RUNS 10 /* timed runs with USE_CLOCK ... */
+#define CLOCK_K    3  /* ... of which the mean of the K fastest counts */
+
 static double Mhz;  /* estimated CPU clock frequency */
 
 extern int verbose; /* -v option in mdriver.c */
@@ -36,6 +39,21 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_CLOCK
+    if (verbose)
+	printf("Measuring performance with the monotonic clock, best %d of %d runs.\n",
+	       CLOCK_K, CLOCK_RUNS);
+#endif
+}
+
+/*
+ * set_fsecs_pinning - Pin the thread to its CPU while timing (default
+ *     on, USE_CLOCK only). Turn it off to time multithreaded functions.
+ */
+void set_fsecs_pinning(int on)
+{
+#if USE_CLOCK
+    ftimer_set_pinning(on);
 #endif
 }
 
@@ -51,7 +69,35 @@ double fsecs(fsecs_test_funct f, void *argp)
     return ftimer_itimer(f, argp, 10);
 #elif USE_GETTOD
     return ftimer_gettod(f, argp, 10);
+#elif USE_CLOCK
+    return ftimer_clock(f, argp, CLOCK_RUNS, CLOCK_K);
 #endif 
 }
 
 
+
+/*
+ * fsecs_setup - Return the running time of a function f (in seconds),
+ *     calling setup before every run and excluding it from the time
+ */
+double fsecs_setup(fsecs_test_funct setup, fsecs_test_funct f, void *argp)
+{
+#if USE_FCYC
+    double cycles = 0;
+    int i;
+
+    for (i = 0; i < 10; i++) {
+	setup(argp);
+	start_counter();
+	f(argp);
+	cycles += get_counter();
+    }
+    return cycles/(10*Mhz*1e6);
+#elif USE_ITIMER
+    return ftimer_itimer_setup(setup, f, argp, 10);
+#elif USE_GETTOD
+    return ftimer_gettod_setup(setup, f, argp, 10);
+#elif USE_CLOCK
+    return ftimer_clock_setup(setup, f, argp, CLOCK_RUNS, CLOCK_K);
+#endif 
+}
@@ -2,3 +2,5 @@ typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+double fsecs_setup(fsecs_test_funct setup, fsecs_test_funct f, void *argp);
+void set_fsecs_pinning(int on);
@@ -7,14 +7,26 @@
  * Function timers that estimate the running time (in seconds) of a function f.
  *    ftimer_itimer: version that uses the interval timer
  *    ftimer_gettod: version that uses gettimeofday
+ *    ftimer_clock: version that uses the monotonic clock, K-best
  */
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
 #include <sys/time.h>
 #include "ftimer.h"
 
+#define FTIMER_WARMUP  2   /* untimed runs before ftimer_clock measures */
+#define FTIMER_MAXRUNS 100 /* most timed runs of ftimer_clock */
+
+static int pinning = 1;    /* ftimer_clock pins the thread to its CPU */
+
 /* function prototypes */
 static void init_etime(void);
 static double get_etime(void);
+static double get_clock(void);
+static int cmp_double(const void *a, const void *b);
 
 /* 
  * ftimer_itimer - Use the interval timer to estimate the running time
@@ -33,6 +45,27 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n)
     return tmeas / n;
 }
 
+/* 
+ * ftimer_itimer_setup - Like ftimer_itimer, but run setup(argp) before
+ * each run of f(argp) and leave it out of the measurement. Return the
+ * average of n runs.
+ */
+double ftimer_itimer_setup(ftimer_test_funct setup, ftimer_test_funct f,
+			   void *argp, int n)
+{
+    double start, tmeas = 0;
+    int i;
+
+    init_etime();
+    for (i = 0; i < n; i++) {
+	setup(argp);
+	start = get_etime();
+	f(argp);
+	tmeas += get_etime() - start;
+    }
+    return tmeas / n;
+}
+
 /* 
  * ftimer_gettod - Use gettimeofday to estimate the running time of
  * f(argp). Return the average of n runs.  
@@ -52,6 +85,114 @@ double ftimer_gettod(ftimer_test_funct f, void *argp, int n)
     return (1E-3*diff);
 }
 
+/* 
+ * ftimer_gettod_setup - Like ftimer_gettod, but run setup(argp) before
+ * each run of f(argp) and leave it out of the measurement. Return the
+ * average of n runs.
+ */
+double ftimer_gettod_setup(ftimer_test_funct setup, ftimer_test_funct f,
+			   void *argp, int n)
+{
+    int i;
+    struct timeval stv, etv;
+    double diff = 0;
+
+    for (i = 0; i < n; i++) {
+	setup(argp);
+	gettimeofday(&stv, NULL);
+	f(argp);
+	gettimeofday(&etv, NULL);
+	diff += 1E3*(etv.tv_sec - stv.tv_sec) + 1E-3*(etv.tv_usec-stv.tv_usec);
+    }
+    diff /= n;
+    return (1E-3*diff);
+}
+
+/* 
+ * ftimer_clock - Use the monotonic clock to estimate the running time
+ * of f(argp). Return the mean of the k fastest of n runs, or the
+ * median with k = 0.
+ */
+double ftimer_clock(ftimer_test_funct f, void *argp, int n, int k)
+{
+    return ftimer_clock_setup(NULL, f, argp, n, k);
+}
+
+/* 
+ * ftimer_clock_setup - Like ftimer_clock, but run setup(argp) (if not
+ * NULL) before each run of f(argp) and leave it out of the measurement.
+ * The warmup runs fault in the heap and fill the caches and branch
+ * predictors; pinning keeps the runs from migrating between CPUs.
+ */
+double ftimer_clock_setup(ftimer_test_funct setup, ftimer_test_funct f,
+			  void *argp, int n, int k)
+{
+    double runs[FTIMER_MAXRUNS], start, sum = 0;
+    cpu_set_t old, one;
+    int i, cpu, pinned = 0;
+
+    if (n > FTIMER_MAXRUNS)
+	n = FTIMER_MAXRUNS;
+    if (n < 1)
+	n = 1;
+    if (k > n)
+	k = n;
+
+    if (pinning && sched_getaffinity(0, sizeof(old), &old) == 0 &&
+	(cpu = sched_getcpu()) >= 0) {
+	CPU_ZERO(&one);
+	CPU_SET(cpu, &one);
+	pinned = (sched_setaffinity(0, sizeof(one), &one) == 0);
+    }
+
+    for (i = 0; i < FTIMER_WARMUP; i++) {
+	if (setup != NULL)
+	    setup(argp);
+	f(argp);
+    }
+    for (i = 0; i < n; i++) {
+	if (setup != NULL)
+	    setup(argp);
+	start = get_clock();
+	f(argp);
+	runs[i] = get_clock() - start;
+    }
+
+    if (pinned)
+	sched_setaffinity(0, sizeof(old), &old);
+
+    qsort(runs, n, sizeof(double), cmp_double);
+    if (k <= 0)
+	return (n % 2) ? runs[n / 2] : (runs[n / 2 - 1] + runs[n / 2]) / 2;
+    for (i = 0; i < k; i++)
+	sum += runs[i];
+    return sum / k;
+}
+
+/*
+ * ftimer_set_pinning - Turn CPU pinning of ftimer_clock on or off
+ */
+void ftimer_set_pinning(int on)
+{
+    pinning = on;
+}
+
+/* return the monotonic clock in seconds */
+static double get_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* qsort comparison for doubles, ascending */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
 
 /*
  * Routines for manipulating the Unix interval timer
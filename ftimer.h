@@ -12,3 +12,29 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n);
    Return the average of n runs */
 double ftimer_gettod(ftimer_test_funct f, void *argp, int n);
 
+
+/* Estimate the running time of f(argp) using the monotonic clock
+   (clock_gettime, nanosecond resolution). Run f FTIMER_WARMUP times
+   untimed first, then n timed runs on the CPU the thread is on. Return
+   the mean of the k fastest runs (k = 1: the fastest), or with k = 0
+   the median run */
+double ftimer_clock(ftimer_test_funct f, void *argp, int n, int k);
+
+/* Same as ftimer_clock, but call setup(argp) before each run, outside
+   the timed window */
+double ftimer_clock_setup(ftimer_test_funct setup, ftimer_test_funct f,
+			  void *argp, int n, int k);
+
+/* Pin the thread to its CPU for ftimer_clock (default on). Turn it off
+   to time functions that start threads of their own */
+void ftimer_set_pinning(int on);
+
+/* Same as ftimer_itimer, but call setup(argp) before each run, outside
+   the timed window. Return the average of n timed runs */
+double ftimer_itimer_setup(ftimer_test_funct setup, ftimer_test_funct f,
+			   void *argp, int n);
+
+/* Same as ftimer_gettod, but call setup(argp) before each run, outside
+   the timed window. Return the average of n timed runs */
+double ftimer_gettod_setup(ftimer_test_funct setup, ftimer_test_funct f,
+			   void *argp, int n);
@@ -0,0 +1,890 @@
+/*
+ * mbench.c - Micro-benchmarks for the mm package that do not fit the
+ *     trace-driven mdriver.
+ *
+ *     unix> mbench <test> [-t <threads>] [-n <iters>] [-d <depth>]
+ *
+ *     cacheline  Per-thread counters allocated with mm_malloc (packed,
+ *                several per cache line) vs mm_malloc_cacheline (one
+ *                line each), hammered by one thread per counter.
+ *     tcache     Small malloc/free churn on 1, 2, 4, ... <threads>
+ *                threads, without and with the per-thread caches.
+ *     remote     Producer/consumer pairs: blocks are allocated on one
+ *                thread and freed on another, locked shared heap vs
+ *                thread heaps with remote-free lists.
+ *     span       Utilization and free latency of small objects: header-
+ *                less slots in spans vs boundary-tagged blocks.
+ *     latency    Latency distribution of malloc and free under a mixed
+ *                workload, with and without the maintenance thread.
+ *     expand     Growable buffers appended to in small pieces: doubling
+ *                with mm_realloc vs using the slack that mm_usable_size
+ *                reports and growing in place with mm_try_expand.
+ *     persist    Building a heap of small objects from scratch vs
+ *                reopening it from its file with mm_heap_open.
+ *     shared     Producer/consumer process pairs (<threads>/2) passing
+ *                messages through a pipe: payloads copied through the
+ *                pipe vs allocated in a shared heap, offsets passed.
+ *                The consumer acks each message, and at most WINDOW
+ *                are in flight.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/wait.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define MAXTHREADS 256
+#define LIVE       64   /* live blocks per thread in the churn tests */
+#define MAXSMALL   256  /* largest request in the churn tests */
+#define QUEUE      1024 /* slots in a producer/consumer queue */
+#define SMALLOBJS  50000 /* live objects in the span test */
+#define LATLIVE    1024  /* live blocks per thread in the latency test */
+#define MAINT_MS   10    /* maintenance period for the latency test */
+#define BUFFERS    256   /* live buffers in the expand test */
+#define BUFMAX     (8 << 10) /* largest length a buffer grows to */
+#define PERSISTOBJS 50000 /* objects in the persist test */
+#define PERSIST_HEAP (1UL << 30) /* room in its heap file */
+#define PERSIST_FILE "/tmp/mbench-persist.heap"
+#define MESSAGES   100000    /* messages per pair in the shared test */
+#define MSGSIZE    (16 << 10) /* bytes per message */
+#define WINDOW     4          /* messages in flight per pair */
+#define SHARED_HEAP (1UL << 30) /* room in the shared heap */
+
+/* Settings from the command line */
+static int nthreads = 4;      /* -t */
+static long iters = 10000000; /* -n */
+static int depth = 8;         /* -d */
+
+static void usage(void);
+static void unix_error(char *msg);
+static double now(void);
+
+/*****************************************************************
+ * cacheline - false sharing between per-thread counters
+ ****************************************************************/
+
+/* One per thread: the counter it increments */
+typedef struct {
+    volatile long *counter;
+} counter_arg_t;
+
+static void *counter_thread(void *vargp)
+{
+    volatile long *c = ((counter_arg_t *)vargp)->counter;
+    long i;
+
+    for (i = 0; i < iters; i++)
+	(*c)++;
+    return NULL;
+}
+
+/*
+ * run_counters - time nthreads threads incrementing their own counters
+ */
+static double run_counters(volatile long **counters)
+{
+    pthread_t tid[MAXTHREADS];
+    counter_arg_t args[MAXTHREADS];
+    double start;
+    int i;
+
+    start = now();
+    for (i = 0; i < nthreads; i++) {
+	args[i].counter = counters[i];
+	if (pthread_create(&tid[i], NULL, counter_thread, &args[i]) != 0)
+	    unix_error("pthread_create failed in run_counters");
+    }
+    for (i = 0; i < nthreads; i++)
+	pthread_join(tid[i], NULL);
+    return now() - start;
+}
+
+/*
+ * shared_lines - number of counters that share a cache line with another
+ */
+static int shared_lines(volatile long **counters)
+{
+    int i, j, n = 0;
+
+    for (i = 0; i < nthreads; i++)
+	for (j = 0; j < nthreads; j++)
+	    if (i != j && ((size_t)counters[i] >> 6) == ((size_t)counters[j] >> 6)) {
+		n++;
+		break;
+	    }
+    return n;
+}
+
+static void bench_cacheline(void)
+{
+    volatile long *counters[MAXTHREADS];
+    double secs;
+    int i, mode;
+
+    printf("%-20s%8s%8s%10s%10s\n", "alloc", "threads", "shared", "secs",
+	   "Mops/s");
+    for (mode = 0; mode < 2; mode++) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    unix_error("mm_init failed in bench_cacheline");
+
+	/* Allocated back to back, the way per-thread state usually is */
+	for (i = 0; i < nthreads; i++) {
+	    counters[i] = mode ? mm_malloc_cacheline(sizeof(long))
+		               : mm_malloc(sizeof(long));
+	    if (counters[i] == NULL)
+		unix_error("allocation failed in bench_cacheline");
+	    *counters[i] = 0;
+	}
+
+	secs = run_counters(counters);
+	printf("%-20s%8d%8d%10.3f%10.1f\n",
+	       mode ? "mm_malloc_cacheline" : "mm_malloc",
+	       nthreads, shared_lines(counters), secs,
+	       nthreads * (double)iters / secs / 1e6);
+
+	for (i = 0; i < nthreads; i++) {
+	    if (mode)
+		mm_free_cacheline((void *)counters[i]);
+	    else
+		mm_free((void *)counters[i]);
+	}
+    }
+}
+
+/*****************************************************************
+ * tcache - small-object churn, scaling with the thread count
+ ****************************************************************/
+
+/*
+ * churn_thread - keep LIVE small blocks per thread and replace a random
+ *     one per iteration, touching each new block
+ */
+static void *churn_thread(void *vargp)
+{
+    unsigned long x = (unsigned long)vargp * 2654435761UL + 1;
+    char *live[LIVE];
+    size_t size;
+    long i;
+    int j;
+
+    memset(live, 0, sizeof(live));
+    for (i = 0; i < iters; i++) {
+	x ^= x << 13; x ^= x >> 7; x ^= x << 17; /* xorshift */
+	j = x % LIVE;
+	if (live[j] != NULL)
+	    mm_free(live[j]);
+	size = (x >> 8) % MAXSMALL + 1;
+	if ((live[j] = mm_malloc(size)) == NULL)
+	    unix_error("mm_malloc failed in churn_thread");
+	live[j][0] = (char)i;
+    }
+    for (j = 0; j < LIVE; j++)
+	if (live[j] != NULL)
+	    mm_free(live[j]);
+    return NULL;
+}
+
+/*
+ * run_churn - time n threads running churn_thread on a fresh heap
+ */
+static double run_churn(int n)
+{
+    pthread_t tid[MAXTHREADS];
+    double start;
+    long i;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	unix_error("mm_init failed in run_churn");
+    start = now();
+    for (i = 0; i < n; i++)
+	if (pthread_create(&tid[i], NULL, churn_thread, (void *)i) != 0)
+	    unix_error("pthread_create failed in run_churn");
+    for (i = 0; i < n; i++)
+	pthread_join(tid[i], NULL);
+    return now() - start;
+}
+
+static void bench_tcache(void)
+{
+    double secs[2];
+    int n, mode;
+
+    printf("%8s%12s%12s%12s%12s%9s\n", "threads", "lock secs", "Mops/s",
+	   "tcache secs", "Mops/s", "speedup");
+    for (n = 1; ; n = (2 * n < nthreads) ? 2 * n : nthreads) {
+	for (mode = 0; mode < 2; mode++) {
+	    mm_set_tcache_depth(mode ? depth : 0);
+	    secs[mode] = run_churn(n);
+	}
+	/* one malloc and one free per iteration */
+	printf("%8d%12.3f%12.2f%12.3f%12.2f%9.2f\n", n,
+	       secs[0], 2.0 * n * iters / secs[0] / 1e6,
+	       secs[1], 2.0 * n * iters / secs[1] / 1e6, secs[0] / secs[1]);
+	if (n == nthreads)
+	    break;
+    }
+}
+
+/*****************************************************************
+ * remote - cross-thread frees between producer/consumer pairs
+ ****************************************************************/
+
+/* Single-producer single-consumer ring of blocks */
+typedef struct {
+    char *slot[QUEUE];
+    long head;          /* next slot the consumer takes */
+    long tail;          /* next slot the producer fills */
+    long bad;           /* blocks that arrived corrupted */
+} queue_t;
+
+static void *producer_thread(void *vargp)
+{
+    queue_t *q = (queue_t *)vargp;
+    unsigned long x = (unsigned long)q | 1;
+    size_t size;
+    char *p;
+    long i;
+
+    for (i = 0; i < iters; i++) {
+	x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+	size = x % MAXSMALL + 1;
+	if ((p = mm_malloc(size)) == NULL)
+	    unix_error("mm_malloc failed in producer_thread");
+	p[0] = p[size - 1] = (char)i;
+	while (i - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) >= QUEUE)
+	    sched_yield();
+	q->slot[i % QUEUE] = p;
+	__atomic_store_n(&q->tail, i + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void *consumer_thread(void *vargp)
+{
+    queue_t *q = (queue_t *)vargp;
+    char *p;
+    long i;
+
+    for (i = 0; i < iters; i++) {
+	while (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) <= i)
+	    sched_yield();
+	p = q->slot[i % QUEUE];
+	if (p[0] != (char)i)
+	    q->bad++;
+	mm_free(p);
+	__atomic_store_n(&q->head, i + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+ * run_pairs - time n producer/consumer pairs on a fresh heap; returns
+ *     the number of corrupted blocks in *bad
+ */
+static double run_pairs(int n, long *bad)
+{
+    pthread_t tid[MAXTHREADS];
+    queue_t *q;
+    double start;
+    int i;
+
+    if ((q = calloc(n, sizeof(queue_t))) == NULL)
+	unix_error("calloc failed in run_pairs");
+    mem_reset_brk();
+    if (mm_init() < 0)
+	unix_error("mm_init failed in run_pairs");
+    start = now();
+    for (i = 0; i < n; i++)
+	if (pthread_create(&tid[2 * i], NULL, producer_thread, &q[i]) != 0 ||
+	    pthread_create(&tid[2 * i + 1], NULL, consumer_thread, &q[i]) != 0)
+	    unix_error("pthread_create failed in run_pairs");
+    for (i = 0; i < 2 * n; i++)
+	pthread_join(tid[i], NULL);
+    start = now() - start;
+    for (*bad = 0, i = 0; i < n; i++)
+	*bad += q[i].bad;
+    free(q);
+    return start;
+}
+
+static void bench_remote(void)
+{
+    unsigned long waits;
+    double secs;
+    long bad;
+    int n, mode;
+
+    printf("%-14s%8s%10s%10s%12s%8s\n", "heap", "pairs", "secs", "Mops/s",
+	   "lock waits", "bad");
+    for (n = 1; ; n = (2 * n < nthreads / 2) ? 2 * n : nthreads / 2) {
+	for (mode = 0; mode < 2; mode++) {
+	    mm_set_tcache_depth(mode ? depth : 0);
+	    waits = mm_lock_waits();
+	    secs = run_pairs(n, &bad);
+	    /* one malloc and one free per block */
+	    printf("%-14s%8d%10.3f%10.2f%12lu%8ld\n",
+		   mode ? "thread heaps" : "shared+lock", n, secs,
+		   2.0 * n * iters / secs / 1e6, mm_lock_waits() - waits, bad);
+	}
+	if (n >= nthreads / 2)
+	    break;
+    }
+}
+
+/*****************************************************************
+ * span - small objects without boundary tags
+ ****************************************************************/
+
+static void bench_span(void)
+{
+    static char *objs[SMALLOBJS];
+    unsigned long x = 88172645463325252UL;
+    size_t payload, size;
+    double secs, ns;
+    char *tmp;
+    long rep, reps;
+    int i, j, mode;
+
+    reps = iters / SMALLOBJS > 0 ? iters / SMALLOBJS : 1;
+    printf("%-14s%10s%10s%12s\n", "blocks", "objects", "util", "ns/free");
+    for (mode = 0; mode < 2; mode++) {
+	mm_set_tcache_depth(mode ? depth : 0);
+	secs = 0;
+	for (rep = 0; rep < reps; rep++) {
+	    mem_reset_brk();
+	    if (mm_init() < 0)
+		unix_error("mm_init failed in bench_span");
+	    payload = 0;
+	    for (i = 0; i < SMALLOBJS; i++) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		size = x % MAXSMALL + 1;
+		if ((objs[i] = mm_malloc(size)) == NULL)
+		    unix_error("mm_malloc failed in bench_span");
+		payload += size;
+	    }
+	    for (i = SMALLOBJS - 1; i > 0; i--) { /* free in random order */
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		j = x % (i + 1);
+		tmp = objs[i]; objs[i] = objs[j]; objs[j] = tmp;
+	    }
+	    secs -= now();
+	    for (i = 0; i < SMALLOBJS; i++)
+		mm_free(objs[i]);
+	    secs += now();
+	}
+	ns = secs / reps / SMALLOBJS * 1e9;
+	printf("%-14s%10d%9.1f%%%12.1f\n", mode ? "span slots" : "boundary tags",
+	       SMALLOBJS, 100.0 * payload / mem_heapsize(), ns);
+    }
+}
+
+/*****************************************************************
+ * latency - tail latency with and without background maintenance
+ ****************************************************************/
+
+/* One per thread: where it records the latency of every call */
+typedef struct {
+    long seed;
+    float *lat;         /* nanoseconds, 2 per iteration */
+} lat_arg_t;
+
+/*
+ * latency_thread - replace a random live block per iteration; mostly
+ *     small blocks, with one in ten between 1 and 17 KB
+ */
+static void *latency_thread(void *vargp)
+{
+    lat_arg_t *arg = (lat_arg_t *)vargp;
+    unsigned long x = arg->seed * 2654435761UL + 1;
+    char *live[LATLIVE];
+    size_t size;
+    double t;
+    long i;
+    int j;
+
+    memset(live, 0, sizeof(live));
+    for (i = 0; i < iters; i++) {
+	x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+	j = x % LATLIVE;
+	size = (x >> 12) % 10 ? (x >> 20) % MAXSMALL + 1
+	                      : (x >> 20) % (16 << 10) + 1024;
+	t = now();
+	if (live[j] != NULL)
+	    mm_free(live[j]);
+	arg->lat[2 * i] = (now() - t) * 1e9;
+	t = now();
+	if ((live[j] = mm_malloc(size)) == NULL)
+	    unix_error("mm_malloc failed in latency_thread");
+	arg->lat[2 * i + 1] = (now() - t) * 1e9;
+	live[j][0] = 1;
+    }
+    for (j = 0; j < LATLIVE; j++)
+	if (live[j] != NULL)
+	    mm_free(live[j]);
+    return NULL;
+}
+
+static int cmp_float(const void *a, const void *b)
+{
+    float x = *(const float *)a, y = *(const float *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void bench_latency(void)
+{
+    pthread_t tid[MAXTHREADS];
+    lat_arg_t args[MAXTHREADS];
+    float *lat;
+    long n, i;
+    int mode;
+
+    n = 2 * iters * nthreads;
+    if ((lat = malloc(n * sizeof(float))) == NULL)
+	unix_error("malloc failed in bench_latency");
+    printf("%-12s%8s%10s%10s%10s%12s%10s\n", "maintenance", "threads",
+	   "p50 ns", "p99 ns", "p99.9 ns", "max ns", "heap KB");
+    for (mode = 0; mode < 2; mode++) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    unix_error("mm_init failed in bench_latency");
+	if (mode && mm_start_maintenance(MAINT_MS) < 0)
+	    unix_error("mm_start_maintenance failed");
+	for (i = 0; i < nthreads; i++) {
+	    args[i].seed = i + 1;
+	    args[i].lat = lat + 2 * iters * i;
+	    if (pthread_create(&tid[i], NULL, latency_thread, &args[i]) != 0)
+		unix_error("pthread_create failed in bench_latency");
+	}
+	for (i = 0; i < nthreads; i++)
+	    pthread_join(tid[i], NULL);
+	if (mode)
+	    mm_stop_maintenance();
+
+	qsort(lat, n, sizeof(float), cmp_float);
+	printf("%-12s%8d%10.0f%10.0f%10.0f%12.0f%10lu\n", mode ? "thread" : "inline",
+	       nthreads, lat[n / 2], lat[n * 99 / 100], lat[n * 999 / 1000],
+	       lat[n - 1], (unsigned long)mem_heapsize() >> 10);
+    }
+    free(lat);
+}
+
+/*****************************************************************
+ * expand - growable buffers: realloc vs in-place growth
+ ****************************************************************/
+
+/* A growable buffer, like a vector or a string builder */
+typedef struct {
+    char *data;
+    size_t len;             /* bytes in use */
+    size_t cap;             /* bytes the buffer believes it can hold */
+    size_t target;          /* length at which it is dropped */
+} gbuf_t;
+
+/*
+ * gbuf_grow - make room for 'need' bytes in 'b', doubling its capacity;
+ *     with 'slack' set, first try to grow without moving. Returns 1 if
+ *     the contents had to be copied.
+ */
+static int gbuf_grow(gbuf_t *b, size_t need, int slack)
+{
+    size_t cap = 2 * b->cap > need ? 2 * b->cap : need;
+    size_t n;
+
+    if (slack && (n = mm_try_expand(b->data, need, cap)) != 0) {
+	b->cap = n;
+	return 0;
+    }
+    if ((b->data = mm_realloc(b->data, cap)) == NULL)
+	unix_error("mm_realloc failed in gbuf_grow");
+    b->cap = slack ? mm_usable_size(b->data) : cap;
+    return 1;
+}
+
+static void bench_expand(void)
+{
+    static gbuf_t bufs[BUFFERS];
+    unsigned long x, copies;
+    size_t chunk, copied;
+    double secs;
+    gbuf_t *b;
+    long i;
+    int j, mode;
+
+    printf("%-14s%10s%10s%12s%10s\n", "growth", "appends", "copies",
+	   "MB copied", "Mops/s");
+    for (mode = 0; mode < 2; mode++) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    unix_error("mm_init failed in bench_expand");
+	memset(bufs, 0, sizeof(bufs));
+	x = 88172645463325252UL;
+	copies = 0;
+	copied = 0;
+	secs = now();
+	for (i = 0; i < iters; i++) {
+	    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+	    b = &bufs[x % BUFFERS];
+	    chunk = (x >> 16) % 64 + 1;
+	    if (b->data == NULL) {
+		b->cap = 16;
+		if ((b->data = mm_malloc(b->cap)) == NULL)
+		    unix_error("mm_malloc failed in bench_expand");
+		if (mode)
+		    b->cap = mm_usable_size(b->data);
+		b->len = 0;
+		b->target = (x >> 24) % BUFMAX + 1;
+	    }
+	    if (b->len + chunk > b->cap && gbuf_grow(b, b->len + chunk, mode)) {
+		copies++;
+		copied += b->len;
+	    }
+	    memset(b->data + b->len, (int)i, chunk);
+	    b->len += chunk;
+	    if (b->len >= b->target) {
+		mm_free(b->data);
+		b->data = NULL;
+	    }
+	}
+	secs = now() - secs;
+	for (j = 0; j < BUFFERS; j++)
+	    if (bufs[j].data != NULL)
+		mm_free(bufs[j].data);
+	printf("%-14s%10ld%10lu%12.1f%10.2f\n",
+	       mode ? "try_expand" : "realloc", iters, copies,
+	       copied / (double)(1 << 20), iters / secs / 1e6);
+    }
+}
+
+/*****************************************************************
+ * persist - cold rebuild vs reattaching a heap file
+ ****************************************************************/
+
+/* The objects are a list linked by heap offsets, found from the root */
+typedef struct {
+    size_t next;            /* offset of the next object, 0 = end */
+    unsigned long key;
+    char data[];
+} pobj_t;
+
+typedef struct {
+    size_t head;            /* offset of the first object */
+    long count;
+    unsigned long sum;      /* of the keys, to check the reattached list */
+} proot_t;
+
+static void bench_persist(void)
+{
+    unsigned long x = 88172645463325252UL, sum = 0;
+    double t, cold, open, walk;
+    proot_t *root;
+    mm_heap_t *h;
+    pobj_t *o;
+    size_t size, off;
+    long i, n = 0;
+
+    unlink(PERSIST_FILE);
+    t = now();
+    if ((h = mm_heap_open(PERSIST_FILE, PERSIST_HEAP)) == NULL)
+	unix_error("mm_heap_open failed in bench_persist");
+    if ((root = mm_heap_malloc(h, sizeof(proot_t))) == NULL)
+	unix_error("mm_heap_malloc failed in bench_persist");
+    root->head = 0;
+    for (i = 0; i < PERSISTOBJS; i++) {
+	x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+	size = x % MAXSMALL + 1;
+	if ((o = mm_heap_malloc(h, sizeof(pobj_t) + size)) == NULL)
+	    unix_error("mm_heap_malloc failed in bench_persist");
+	o->key = x;
+	memset(o->data, (int)x, size);
+	o->next = root->head;
+	root->head = mm_heap_offset(h, o);
+	sum += x;
+    }
+    root->count = PERSISTOBJS;
+    root->sum = sum;
+    mm_heap_set_root(h, root);
+    mm_heap_destroy(h);
+    cold = now() - t;
+
+    t = now();
+    if ((h = mm_heap_open(PERSIST_FILE, PERSIST_HEAP)) == NULL)
+	unix_error("mm_heap_open failed to reattach in bench_persist");
+    root = mm_heap_root(h);
+    open = now() - t;
+    sum = 0;
+    for (off = root->head; off != 0; off = o->next) {
+	o = mm_heap_at(h, off);
+	sum += o->key;
+	n++;
+    }
+    walk = now() - t;
+    if (n != root->count || sum != root->sum)
+	printf("reattached heap is corrupt: %ld of %ld objects\n",
+	       n, root->count);
+    mm_heap_destroy(h);
+    unlink(PERSIST_FILE);
+
+    printf("%-18s%10s%12s\n", "phase", "objects", "ms");
+    printf("%-18s%10d%12.2f\n", "cold rebuild", PERSISTOBJS, cold * 1e3);
+    printf("%-18s%10d%12.2f\n", "reattach", PERSISTOBJS, open * 1e3);
+    printf("%-18s%10ld%12.2f\n", "reattach + walk", n, walk * 1e3);
+}
+
+/*****************************************************************
+ * shared - passing messages between processes: copy vs shared heap
+ ****************************************************************/
+
+/*
+ * xfer - move all 'len' bytes through pipe end 'fd', in either direction
+ */
+static int xfer(int fd, void *buf, size_t len, int out)
+{
+    char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+	n = out ? write(fd, p, len) : read(fd, p, len);
+	if (n <= 0)
+	    return -1;
+	p += n;
+	len -= n;
+    }
+    return 0;
+}
+
+/*
+ * producer - fill and send MESSAGES messages: the bytes themselves, or
+ *     the offset of a block of shared heap 'h'. Waits for acks on 'ack'
+ *     to keep WINDOW messages in flight. Returns the exit status.
+ */
+static int producer(mm_heap_t *h, int fd, int ack)
+{
+    char *msg = NULL, acks[WINDOW];
+    long i, acked = 0;
+    ssize_t n;
+    size_t off;
+
+    if (h == NULL && (msg = malloc(MSGSIZE)) == NULL)
+	return 1;
+    for (i = 0; i < MESSAGES; i++) {
+	while (i - acked >= WINDOW) {
+	    if ((n = read(ack, acks, sizeof(acks))) <= 0)
+		return 1;
+	    acked += n;
+	}
+	if (h != NULL && (msg = mm_heap_malloc(h, MSGSIZE)) == NULL)
+	    return 1;
+	memset(msg, (int)i, MSGSIZE);
+	if (h != NULL) {
+	    off = mm_heap_offset(h, msg);
+	    if (xfer(fd, &off, sizeof(off), 1) < 0)
+		return 1;
+	}
+	else if (xfer(fd, msg, MSGSIZE, 1) < 0)
+	    return 1;
+    }
+    while (acked < MESSAGES) { /* the consumer must not find ack closed */
+	if ((n = read(ack, acks, sizeof(acks))) <= 0)
+	    return 1;
+	acked += n;
+    }
+    return 0;
+}
+
+/*
+ * consumer - receive MESSAGES messages, read every byte of each, free
+ *     the shared ones, and ack each on 'ack'. Returns the exit status.
+ */
+static int consumer(mm_heap_t *h, int fd, int ack)
+{
+    char *msg = NULL;
+    unsigned long sum;
+    size_t off, j;
+    long i;
+
+    if (h == NULL && (msg = malloc(MSGSIZE)) == NULL)
+	return 1;
+    for (i = 0; i < MESSAGES; i++) {
+	if (h != NULL) {
+	    if (xfer(fd, &off, sizeof(off), 0) < 0)
+		return 1;
+	    msg = mm_heap_at(h, off);
+	}
+	else if (xfer(fd, msg, MSGSIZE, 0) < 0)
+	    return 1;
+	for (sum = 0, j = 0; j < MSGSIZE; j += sizeof(long))
+	    sum += *(unsigned long *)(msg + j);
+	if (sum != (MSGSIZE / sizeof(long)) * (0x0101010101010101UL *
+						 (unsigned char)i))
+	    return 1;
+	if (h != NULL)
+	    mm_heap_free(h, msg);
+	if (xfer(ack, "", 1, 1) < 0)
+	    return 1;
+    }
+    return 0;
+}
+
+static void bench_shared(void)
+{
+    pid_t pid[MAXTHREADS];
+    int pairs = nthreads / 2 > 0 ? nthreads / 2 : 1;
+    int fd[2], ack[2], i, mode, status, bad;
+    mm_heap_t *h;
+    double secs;
+
+    printf("%-10s%8s%12s%12s%10s\n", "messages", "pairs", "msgs/s", "MB/s",
+	   "failed");
+    for (mode = 0; mode < 2; mode++) {
+	h = NULL;
+	if (mode && (h = mm_heap_create_shared(SHARED_HEAP)) == NULL)
+	    unix_error("mm_heap_create_shared failed in bench_shared");
+	fflush(stdout);
+	secs = now();
+	for (i = 0; i < pairs; i++) {
+	    if (pipe(fd) < 0 || pipe(ack) < 0)
+		unix_error("pipe failed in bench_shared");
+	    if ((pid[2 * i] = fork()) == 0) {
+		close(fd[1]);
+		close(ack[0]);
+		_exit(consumer(h, fd[0], ack[1]));
+	    }
+	    if ((pid[2 * i + 1] = fork()) == 0) {
+		close(fd[0]);
+		close(ack[1]);
+		_exit(producer(h, fd[1], ack[0]));
+	    }
+	    if (pid[2 * i] < 0 || pid[2 * i + 1] < 0)
+		unix_error("fork failed in bench_shared");
+	    close(fd[0]);
+	    close(fd[1]);
+	    close(ack[0]);
+	    close(ack[1]);
+	}
+	bad = 0;
+	for (i = 0; i < 2 * pairs; i++)
+	    if (waitpid(pid[i], &status, 0) < 0 || !WIFEXITED(status) ||
+		WEXITSTATUS(status) != 0)
+		bad++;
+	secs = now() - secs;
+	printf("%-10s%8d%12.0f%12.1f%10d\n", mode ? "shared" : "copied",
+	       pairs, pairs * MESSAGES / secs,
+	       (double)pairs * MESSAGES * MSGSIZE / secs / (1 << 20), bad);
+	mm_heap_destroy(h);
+    }
+}
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+    char *test;
+    int c;
+
+    if (argc < 2) {
+	usage();
+	exit(1);
+    }
+    test = argv[1];
+    optind = 2;
+    while ((c = getopt(argc, argv, "t:n:d:h")) != EOF) {
+	switch (c) {
+	case 't':
+	    nthreads = atoi(optarg);
+	    if (nthreads < 1 || nthreads > MAXTHREADS) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'n':
+	    iters = atol(optarg);
+	    break;
+	case 'd':
+	    depth = atoi(optarg);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+
+    mem_init();
+    if (!strcmp(test, "cacheline"))
+	bench_cacheline();
+    else if (!strcmp(test, "tcache"))
+	bench_tcache();
+    else if (!strcmp(test, "remote"))
+	bench_remote();
+    else if (!strcmp(test, "span"))
+	bench_span();
+    else if (!strcmp(test, "latency"))
+	bench_latency();
+    else if (!strcmp(test, "expand"))
+	bench_expand();
+    else if (!strcmp(test, "persist"))
+	bench_persist();
+    else if (!strcmp(test, "shared"))
+	bench_shared();
+    else {
+	usage();
+	exit(1);
+    }
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * now - wall-clock seconds from the monotonic clock
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mbench <test> [-h] [-t <threads>] [-n <iters>] [-d <depth>]\n");
+    fprintf(stderr, "Tests\n");
+    fprintf(stderr, "\tcacheline  Per-thread counters: mm_malloc vs mm_malloc_cacheline.\n");
+    fprintf(stderr, "\ttcache     Small-object churn on 1..<threads> threads, locked vs cached.\n");
+    fprintf(stderr, "\tremote     Producer/consumer pairs (<threads>/2), locked vs remote frees.\n");
+    fprintf(stderr, "\tspan       Small-object utilization and free latency, spans vs tags.\n");
+    fprintf(stderr, "\tlatency    malloc/free latency percentiles, maintenance thread off/on.\n");
+    fprintf(stderr, "\texpand     Growable buffers: mm_realloc vs slack and mm_try_expand.\n");
+    fprintf(stderr, "\tpersist    Small-object heap: cold rebuild vs reattaching its file.\n");
+    fprintf(stderr, "\tshared     Process pairs (<threads>/2): messages copied vs shared heap.\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-d <depth> Per-thread cache depth for tcache.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-n <iters> Iterations per thread.\n");
+    fprintf(stderr, "\t-t <n>     Number of threads.\n");
+}
@@ -15,10 +15,14 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/resource.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "perfctr.h"
 #include "config.h"
 
 /**********************
@@ -29,9 +33,21 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define CHASE_REPS   100 /* pointer chases per timed run in -n mode */
+#define TLB_READS (1 << 20) /* random reads per timed run in -p mode */
+
+/* Lifetime oracle thresholds (-o), as fractions of the trace length */
+#define LIFE_SHORT_FRAC 0.01 /* lifetimes below this are MM_LIFE_SHORT */
+#define LIFE_LONG_FRAC  0.25 /* lifetimes from this up are MM_LIFE_LONG */
+
+#define MAXTHREADS   256 /* most replay threads for -T */
+#define MAXHEAPS     8   /* most heap instances for -S */
+#define SEARCH_BINS  13  /* search length histogram of -s: 0, 1, 2-3 .. 1K+ */
+#define SEARCH_WORST 3   /* requests with the longest searches shown by -s */
+#define PERF_RUNS    10  /* counted runs per trace for -e, averaged */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((size_t)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
@@ -49,6 +65,7 @@ typedef struct {
     enum {ALLOC, FREE, REALLOC} type; /* type of request */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
+    int tid;                          /* thread issuing the request (a:<tid>) */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -57,6 +74,7 @@ typedef struct {
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
+    int num_threads;     /* 1 + the largest thread id in the trace */
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
@@ -72,6 +90,101 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* Parameters for the pointer-chasing function timed in -n mode */
+typedef struct {
+    char *head;      /* first block of the chain */
+    int reps;        /* number of walks over the chain per run */
+} chase_t;
+
+/* Parameters for the random reads timed in -p mode */
+typedef struct {
+    char **blocks;   /* live blocks at the peak of the trace */
+    int *sizes;      /* their sizes */
+    int n;           /* number of live blocks */
+} tlbwalk_t;
+
+/* Results of the -p mode for one trace */
+typedef struct {
+    int valid;       /* did the replay succeed? */
+    size_t live;     /* payload bytes live at the peak */
+    size_t huge;     /* heap bytes backed by transparent huge pages */
+    double secs;     /* time of TLB_READS random reads */
+} tlb_t;
+
+/* Layout results of the -n mode for one trace, [0] = mm_malloc and
+   [1] = mm_malloc_near with the previous allocation as the hint */
+typedef struct {
+    int valid;       /* did both replays succeed? */
+    int nodes;       /* live blocks at the peak of the trace */
+    double dist[2];  /* mean byte distance between consecutive nodes */
+    double secs[2];  /* time of one walk over all nodes */
+} near_t;
+
+/* Results of the -o replay with oracle lifetime hints for one trace */
+typedef struct {
+    int valid;       /* was the class-hinted replay correct? */
+    double util;     /* space utilization with lifetime class hints */
+    int count[4];    /* number of ids in each MM_LIFE_* class */
+} oracle_t;
+
+/* Results of the -z sized-free replay for one trace */
+typedef struct {
+    int valid;       /* were both replays correct? */
+    double util[2];  /* [0] boundary tags only, [1] sized frees and slots */
+} sized_t;
+
+/* Results of the -s search length replay for one trace */
+typedef struct {
+    int valid;           /* was the replay correct? */
+    int nreqs;           /* number of mallocs and reallocs */
+    unsigned long hist[SEARCH_BINS]; /* requests by blocks looked at */
+    unsigned long pct[4];/* 50th, 90th, 99th percentile and longest */
+    double wrapped;      /* share of the blocks looked at after wrapping */
+    int worst[SEARCH_WORST]; /* requests with the longest searches, -1 = none */
+    int worst_size[SEARCH_WORST];        /* their sizes */
+    unsigned long worst_len[SEARCH_WORST]; /* and their searches */
+} search_t;
+
+/* Hardware event counts of -e for one trace, per run of the trace */
+typedef struct {
+    int valid;           /* were the events counted? */
+    double ops;          /* number of ops in the trace */
+    double counts[PC_EVENTS]; /* -1 = event not available */
+} perf_t;
+
+/* Results of the -S split replay for one trace */
+typedef struct {
+    int valid;              /* was the split replay correct? */
+    double util;            /* peak payload over all heaps / their total size */
+    double heap_util[MAXHEAPS]; /* the same for each heap on its own */
+} split_t;
+
+/*
+ * Holds the state of a threaded replay (-T). Each thread runs its own
+ * requests in trace order. A request waits until all earlier requests
+ * on the same id have completed, which keeps cross-thread frees and
+ * reallocs ordered like in the trace.
+ */
+typedef struct {
+    trace_t *trace;
+    int nthreads;        /* number of replay threads */
+    int check;           /* check payloads (untimed run) */
+    int *seq;            /* per request: earlier requests on the same id */
+    int *done;           /* per id: requests on it completed so far */
+    int **ops;           /* per thread: indices of its requests */
+    int *num_ops;        /* per thread: number of its requests */
+    int errors;          /* errors found by the replay threads */
+    size_t live;         /* payload allocated right now (checked run) */
+    size_t peak;         /* peak of live during the checked run */
+    size_t heapsize;     /* heap size after the checked run */
+} replay_t;
+
+/* Argument of one replay thread */
+typedef struct {
+    replay_t *replay;
+    int tid;
+} replay_arg_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -81,6 +194,10 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    long faults[2];  /* minor page faults: checked runs, timed runs */
+    long syscalls[2];/* memlib system calls: checked runs, timed runs */
+    struct mm_stats heap; /* free blocks at the peak, search and coalesce
+			     counts over the whole utilization run */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -91,6 +208,7 @@ typedef struct {
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
+static size_t heap_reserve = MAX_HEAP; /* -H: address space of each heap */
 
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
@@ -108,6 +226,8 @@ static char *default_tracefiles[] = {
 /* these functions manipulate range lists */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
+static int add_range_in(range_t **ranges, char *lo, int size, int in_heap,
+			int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
 
@@ -122,11 +242,64 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   struct mm_stats *heap);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_reset(void *ptr);
+static void eval_mm_ops(void *ptr);
+
+/* Placement hint experiment (-n) */
+static int trace_peak(trace_t *trace);
+static int eval_mm_near(trace_t *trace, int tracenum, range_t **ranges,
+			int use_hint, near_t *near);
+static void eval_chase(void *ptr);
+
+/* Page size experiment (-p) */
+static int eval_mm_tlb(trace_t *trace, int tracenum, tlb_t *tlb);
+static void eval_tlb_walk(void *ptr);
+static size_t huge_bytes(void *lo, void *hi);
+static void printtlb(int n, tlb_t *tlb);
+
+/* Page faults (-F) */
+static long minor_faults(void);
+static void printfaults(int n, stats_t *stats);
+static void printheap(int n, stats_t *stats);
+static void printnear(int n, near_t *near);
+
+/* Threaded replay (-T) */
+static replay_t *init_replay(trace_t *trace, int nthreads);
+static void free_replay(replay_t *replay);
+static int eval_mm_threads_valid(replay_t *replay, int tracenum);
+static void eval_mm_threads(void *ptr);
+static void *replay_thread(void *vargp);
+
+/* Lifetime oracle experiment (-o) */
+static int eval_mm_oracle(trace_t *trace, int tracenum, range_t **ranges,
+			  oracle_t *oracle);
+static void printoracle(int n, stats_t *stats, oracle_t *oracle);
+
+/* Sized free experiment (-z) */
+static int eval_mm_sized(trace_t *trace, int tracenum, range_t **ranges,
+			 int sized, sized_t *stats);
+static void printsized(int n, sized_t *sized);
+
+/* Fit search lengths (-s) */
+static int eval_mm_search(trace_t *trace, int tracenum, range_t **ranges,
+			  search_t *stats);
+static int cmp_ulong(const void *a, const void *b);
+static void printsearch(int n, search_t *search);
+
+/* Hardware event counters (-e) */
+static void printperf(int n, perf_t *perf);
+
+/* Heap instance experiment (-S) */
+static int eval_mm_split(trace_t *trace, int tracenum, range_t **ranges,
+			 int nheaps, split_t *split);
+static void printsplit(int n, int nheaps, stats_t *stats, split_t *split);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static size_t parse_size(char *arg);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -145,11 +318,32 @@ int main(int argc, char **argv)
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    near_t *near_stats = NULL; /* placement hint results (-n) */
+    oracle_t *oracle_stats = NULL; /* lifetime oracle results (-o) */
+    stats_t *thread_stats = NULL;  /* threaded replay results (-T) */
+    split_t *split_stats = NULL;   /* heap instance results (-S) */
+    tlb_t *tlb_stats = NULL;       /* page size results (-p) */
+    sized_t *sized_stats = NULL;   /* sized free results (-z) */
+    search_t *search_stats = NULL; /* search length results (-s) */
+    perf_t *perf_stats = NULL;     /* hardware event counts (-e) */
+    replay_t *replay;              /* state of one threaded replay */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int ops_only = 0;    /* If set, time only the op stream (set by -r) */
+    int near_mode = 0;   /* If set, run the placement hint experiment (-n) */
+    int oracle_mode = 0; /* If set, replay with lifetime class hints (-o) */
+    int nthreads = 0;    /* If set, also replay on this many threads (-T) */
+    int nheaps = 0;      /* If set, also split the ids over this many heaps (-S) */
+    int tlb_mode = 0;    /* If set, time random reads on the chosen pages (-p) */
+    int fault_mode = 0;  /* If set, prefault as told and report faults (-F) */
+    int sized_mode = 0;  /* If set, replay with sized frees (-z) */
+    int search_mode = 0; /* If set, measure fit search lengths (-s) */
+    int perf_mode = 0;   /* If set, count hardware events of the runs (-e) */
+    long faults;         /* minor faults before a phase */
+    long syscalls;       /* memlib system calls before a phase */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +352,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalrnow:T:c:PH:S:p:F:zse")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,6 +378,73 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'r': /* Keep heap reset and mm_init out of the timed window */
+            ops_only = 1;
+            break;
+        case 'n': /* Replay with placement hints and time pointer chasing */
+            near_mode = 1;
+            break;
+        case 'o': /* Replay with lifetime classes taken from the trace */
+            oracle_mode = 1;
+            break;
+        case 'w': /* Search window of mm_malloc_near in bytes */
+            mm_set_near_window(atoi(optarg));
+            break;
+        case 'z': /* Replay with sized frees, header-less slots vs tags */
+            sized_mode = 1;
+            break;
+        case 's': /* Replay measuring the fit search of every request */
+            search_mode = 1;
+            break;
+        case 'e': /* Count hardware events of the timed runs */
+            perf_mode = 1;
+            break;
+        case 'P': /* Per-CPU instead of per-thread heaps */
+            mm_set_cache_mode(MM_CACHE_CPU);
+            break;
+        case 'c': /* Per-thread cache depth, 0 = no caches */
+            mm_set_tcache_depth(atoi(optarg));
+            break;
+        case 'H': /* Address space reserved for the heap */
+            heap_reserve = parse_size(optarg);
+            mem_set_reserve(heap_reserve);
+            break;
+        case 'F': /* Prefault policy: none, eager or <n> pages ahead */
+            if (!strcmp(optarg, "eager"))
+		mem_set_prefault(MEM_PREFAULT_EAGER, 0);
+            else if (atoi(optarg) > 0)
+		mem_set_prefault(MEM_PREFAULT_AHEAD, atoi(optarg));
+            else if (strcmp(optarg, "none")) {
+		usage();
+		exit(1);
+	    }
+            fault_mode = 1;
+            break;
+        case 'p': /* Pages backing the heap: 4k, thp or huge */
+            if (!strcmp(optarg, "thp"))
+		mem_set_pages(MEM_PAGES_THP);
+            else if (!strcmp(optarg, "huge"))
+		mem_set_pages(MEM_PAGES_HUGETLB);
+            else if (strcmp(optarg, "4k")) {
+		usage();
+		exit(1);
+	    }
+            tlb_mode = 1;
+            break;
+        case 'S': /* Split each trace's ids across this many heaps */
+            nheaps = atoi(optarg);
+            if (nheaps < 1 || nheaps > MAXHEAPS) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'T': /* Replay each trace on this many threads */
+            nthreads = atoi(optarg);
+            if (nthreads < 1 || nthreads > MAXTHREADS) {
+		usage();
+		exit(1);
+	    }
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -283,9 +544,64 @@ int main(int argc, char **argv)
     mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
     if (mm_stats == NULL)
 	unix_error("mm_stats calloc in main failed");
+    if (near_mode &&
+	(near_stats = (near_t *)calloc(num_tracefiles, sizeof(near_t))) == NULL)
+	unix_error("near_stats calloc in main failed");
+    if (oracle_mode &&
+	(oracle_stats = (oracle_t *)calloc(num_tracefiles,
+					   sizeof(oracle_t))) == NULL)
+	unix_error("oracle_stats calloc in main failed");
+    if (sized_mode &&
+	(sized_stats = (sized_t *)calloc(num_tracefiles,
+					 sizeof(sized_t))) == NULL)
+	unix_error("sized_stats calloc in main failed");
+    if (search_mode &&
+	(search_stats = (search_t *)calloc(num_tracefiles,
+					   sizeof(search_t))) == NULL)
+	unix_error("search_stats calloc in main failed");
+    if (perf_mode &&
+	(perf_stats = (perf_t *)calloc(num_tracefiles, sizeof(perf_t))) == NULL)
+	unix_error("perf_stats calloc in main failed");
+
+    /* Open the hardware counters, skipping those we cannot have */
+    if (perf_mode) {
+	if (perfctr_init() == 0) {
+	    printf("Hardware counters: none available, -e skipped\n");
+	    perf_mode = 0;
+	}
+	else {
+	    printf("Hardware counters:");
+	    for (i = 0; i < PC_EVENTS; i++)
+		printf(" %s%s", perfctr_name(i),
+		       perfctr_available(i) ? "" : " (unavailable)");
+	    printf("\n");
+	}
+    }
+    if (nthreads &&
+	(thread_stats = (stats_t *)calloc(num_tracefiles,
+					  sizeof(stats_t))) == NULL)
+	unix_error("thread_stats calloc in main failed");
+    if (nheaps &&
+	(split_stats = (split_t *)calloc(num_tracefiles,
+					 sizeof(split_t))) == NULL)
+	unix_error("split_stats calloc in main failed");
+    if (tlb_mode &&
+	(tlb_stats = (tlb_t *)calloc(num_tracefiles, sizeof(tlb_t))) == NULL)
+	unix_error("tlb_stats calloc in main failed");
     
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
+    if (tlb_mode) {
+	if (mem_pages() == MEM_PAGES_HUGETLB)
+	    printf("Heap pages: hugetlb (%lu KB)\n",
+		   (unsigned long)mem_hugepagesize() / 1024);
+	else if (mem_pages() == MEM_PAGES_THP)
+	    printf("Heap pages: transparent huge pages (%lu KB)\n",
+		   (unsigned long)mem_hugepagesize() / 1024);
+	else
+	    printf("Heap pages: normal (%lu KB)\n",
+		   (unsigned long)mem_pagesize() / 1024);
+    }
 
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
@@ -293,16 +609,71 @@ int main(int argc, char **argv)
 	mm_stats[i].ops = trace->num_ops;
 	if (verbose > 1)
 	    printf("Checking mm_malloc for correctness, ");
+	faults = minor_faults();
+	syscalls = mem_syscalls();
 	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
 	if (mm_stats[i].valid) {
 	    if (verbose > 1)
 		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+	    mm_stats[i].util = eval_mm_util(trace, i, &ranges,
+					    &mm_stats[i].heap);
+	    mm_stats[i].faults[0] = minor_faults() - faults;
+	    mm_stats[i].syscalls[0] = mem_syscalls() - syscalls;
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    faults = minor_faults();
+	    syscalls = mem_syscalls();
+	    if (ops_only)
+		mm_stats[i].secs = fsecs_setup(eval_mm_reset, eval_mm_ops,
+					       &speed_params);
+	    else
+		mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    mm_stats[i].faults[1] = minor_faults() - faults;
+	    mm_stats[i].syscalls[1] = mem_syscalls() - syscalls;
+	    if (perf_mode) {
+		perf_stats[i].ops = trace->num_ops;
+		if (ops_only)
+		    perf_stats[i].valid =
+			perfctr_run(eval_mm_reset, eval_mm_ops, &speed_params,
+				    PERF_RUNS, perf_stats[i].counts) == 0;
+		else
+		    perf_stats[i].valid =
+			perfctr_run(NULL, eval_mm_speed, &speed_params,
+				    PERF_RUNS, perf_stats[i].counts) == 0;
+	    }
+	    if (near_mode)
+		near_stats[i].valid =
+		    eval_mm_near(trace, i, &ranges, 0, &near_stats[i]) &&
+		    eval_mm_near(trace, i, &ranges, 1, &near_stats[i]);
+	    if (oracle_mode)
+		oracle_stats[i].valid =
+		    eval_mm_oracle(trace, i, &ranges, &oracle_stats[i]);
+	    if (tlb_mode)
+		tlb_stats[i].valid = eval_mm_tlb(trace, i, &tlb_stats[i]);
+	    if (sized_mode)
+		sized_stats[i].valid =
+		    eval_mm_sized(trace, i, &ranges, 0, &sized_stats[i]) &&
+		    eval_mm_sized(trace, i, &ranges, 1, &sized_stats[i]);
+	    if (search_mode)
+		search_stats[i].valid =
+		    eval_mm_search(trace, i, &ranges, &search_stats[i]);
+	    if (nheaps)
+		split_stats[i].valid =
+		    eval_mm_split(trace, i, &ranges, nheaps, &split_stats[i]);
+	    if (nthreads) {
+		replay = init_replay(trace, nthreads);
+		thread_stats[i].ops = trace->num_ops;
+		thread_stats[i].valid = eval_mm_threads_valid(replay, i);
+		if (thread_stats[i].valid) {
+		    thread_stats[i].util = (double)replay->peak / replay->heapsize;
+		    set_fsecs_pinning(0); /* the replay threads need CPUs */
+		    thread_stats[i].secs = fsecs(eval_mm_threads, replay);
+		    set_fsecs_pinning(1);
+		}
+		free_replay(replay);
+	    }
 	}
 	free_trace(trace);
     }
@@ -311,6 +682,55 @@ int main(int argc, char **argv)
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
+	printf("\nFree blocks at the peak, fit searches and coalesces:\n");
+	printheap(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (near_mode) {
+	printf("\nPlacement hints (mm_malloc vs mm_malloc_near):\n");
+	printnear(num_tracefiles, near_stats);
+	printf("\n");
+    }
+    if (nthreads) {
+	printf("\nThreaded replay on %d threads:\n", nthreads);
+	printresults(num_tracefiles, thread_stats);
+	printf("\n");
+    }
+    if (oracle_mode) {
+	printf("\nUtilization with oracle lifetime hints (mm_malloc vs mm_malloc_class):\n");
+	printoracle(num_tracefiles, mm_stats, oracle_stats);
+	printf("\n");
+    }
+    if (sized_mode) {
+	printf("\nSized frees (boundary tags only vs header-less slots):\n");
+	printsized(num_tracefiles, sized_stats);
+	printf("\n");
+    }
+    if (perf_mode) {
+	printf("\nHardware events of the timed runs:\n");
+	printperf(num_tracefiles, perf_stats);
+	printf("\n");
+	perfctr_deinit();
+    }
+    if (search_mode) {
+	printf("\nFit search lengths (blocks looked at per malloc or realloc):\n");
+	printsearch(num_tracefiles, search_stats);
+	printf("\n");
+    }
+    if (fault_mode) {
+	printf("\nMinor page faults and memlib system calls:\n");
+	printfaults(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (tlb_mode) {
+	printf("\nRandom reads over the live blocks at the peak:\n");
+	printtlb(num_tracefiles, tlb_stats);
+	printf("\n");
+    }
+    if (nheaps) {
+	printf("\nIds split across %d heaps (one heap vs mm_heap_create):\n",
+	       nheaps);
+	printsplit(num_tracefiles, nheaps, mm_stats, split_stats);
 	printf("\n");
     }
 
@@ -380,6 +800,17 @@ int main(int argc, char **argv)
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
+{
+    return add_range_in(ranges, lo, size, 1, tracenum, opnum);
+}
+
+/*
+ * add_range_in - add_range that checks the block against the extent of
+ *     the memlib heap only if 'in_heap' is set. Blocks of mm_heap_create
+ *     heaps live in memlib heaps of their own.
+ */
+static int add_range_in(range_t **ranges, char *lo, int size, int in_heap,
+			int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
     range_t *p;
@@ -396,8 +827,9 @@ static int add_range(range_t **ranges, char *lo, int size,
     }
 
     /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    if (in_heap &&
+	((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi()))) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
@@ -480,6 +912,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
     unsigned index, size;
     unsigned max_index = 0;
     unsigned op_index;
+    int tid;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -518,7 +951,13 @@ static trace_t *read_trace(char *tracedir, char *filename)
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
+    trace->num_threads = 1;
     while (fscanf(tracefile, "%s", type) != EOF) {
+	/* "a:<tid>" etc. issue the request from thread <tid> */
+	tid = (type[1] == ':') ? atoi(type + 2) : 0;
+	trace->ops[op_index].tid = tid;
+	if (tid >= trace->num_threads)
+	    trace->num_threads = tid + 1;
 	switch(type[0]) {
 	case 'a':
 	    fscanf(tracefile, "%u %u", &index, &size);
@@ -693,18 +1132,25 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   package on the trace. Note that our implementation of mem_sbrk() 
  *   doesn't allow the students to decrement the brk pointer, so brk
  *   is always the high water mark of the heap. 
- *   
+ *   Also takes the mm_get_stats of the heap at the peak of the trace,
+ *   with the search, wrap and coalesce counts of the whole run, into heap.
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   struct mm_stats *heap)
 {   
     int i;
     int index;
+    int peak = trace_peak(trace);
+    struct mm_stats end;
     int size, newsize, oldsize;
-    int max_total_size = 0;
-    int total_size = 0;
+    long max_total_size = 0;
+    long total_size = 0;
     char *p;
     char *newp, *oldp;
 
+    (void)tracenum;
+    (void)ranges;
+
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
     if (mm_init() < 0)
@@ -772,8 +1218,15 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+	if (i == peak)
+	    mm_get_stats(heap);
     }
 
+    mm_get_stats(&end);
+    heap->searches = end.searches;
+    heap->probes = end.probes;
+    heap->wraps = end.wraps;
+    memcpy(heap->coalesce, end.coalesce, sizeof(heap->coalesce));
     return ((double)max_total_size / (double)mem_heapsize());
 }
 
@@ -784,15 +1237,35 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
-    char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
-
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
     if (mm_init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
+    eval_mm_ops(ptr);
+}
+
+/*
+ * eval_mm_reset - Setup function for the -r timing mode. Empties the
+ *    mm package with mm_reset, keeping the heap grown by earlier runs.
+ */
+static void eval_mm_reset(void *ptr)
+{
+    (void)ptr;
+    if (mm_reset() < 0)
+	app_error("mm_reset failed in eval_mm_reset");
+}
+
+/*
+ * eval_mm_ops - Replay the trace requests against an already
+ *    initialized mm package. This is the timed part of every run.
+ */
+static void eval_mm_ops(void *ptr)
+{
+    int i, index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
     /* Interpret each trace request */
     for (i = 0;  i < trace->num_ops;  i++)
         switch (trace->ops[i].type) {
@@ -821,115 +1294,965 @@ static void eval_mm_speed(void *ptr)
             break;
 
 	default:
-	    app_error("Nonexistent request type in eval_mm_valid");
+	    app_error("Nonexistent request type in eval_mm_ops");
         }
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * init_replay - Split the trace into per-thread request lists for a
+ *    threaded replay on nthreads threads. Thread ids from the trace are
+ *    folded onto the replay threads; a trace without thread ids is
+ *    split by request id.
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static replay_t *init_replay(trace_t *trace, int nthreads)
 {
-    int i, newsize;
-    char *p, *newp, *oldp;
+    replay_t *replay;
+    int *count;
+    int i, t;
+
+    if ((replay = (replay_t *)calloc(1, sizeof(replay_t))) == NULL ||
+	(replay->seq = (int *)malloc(trace->num_ops * sizeof(int))) == NULL ||
+	(replay->done = (int *)calloc(trace->num_ids, sizeof(int))) == NULL ||
+	(replay->ops = (int **)calloc(nthreads, sizeof(int *))) == NULL ||
+	(replay->num_ops = (int *)calloc(nthreads, sizeof(int))) == NULL ||
+	(count = (int *)calloc(trace->num_ids, sizeof(int))) == NULL)
+	unix_error("malloc failed in init_replay");
+    replay->trace = trace;
+    replay->nthreads = nthreads;
+
+    for (t = 0; t < nthreads; t++)
+	if ((replay->ops[t] = (int *)malloc(trace->num_ops * sizeof(int))) == NULL)
+	    unix_error("malloc failed in init_replay");
+
+    for (i = 0; i < trace->num_ops; i++) {
+	replay->seq[i] = count[trace->ops[i].index]++;
+	t = (trace->num_threads > 1) ? trace->ops[i].tid : trace->ops[i].index;
+	t %= nthreads;
+	replay->ops[t][replay->num_ops[t]++] = i;
+    }
+    free(count);
+    return replay;
+}
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+/*
+ * free_replay - Free everything allocated by init_replay
+ */
+static void free_replay(replay_t *replay)
+{
+    int t;
+
+    for (t = 0; t < replay->nthreads; t++)
+	free(replay->ops[t]);
+    free(replay->ops);
+    free(replay->num_ops);
+    free(replay->seq);
+    free(replay->done);
+    free(replay);
+}
 
-        case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
-		unix_error("System message");
-	    }
-	    trace->blocks[trace->ops[i].index] = p;
+/*
+ * eval_mm_threads_valid - Run the threaded replay once with payload
+ *    checks: every block must be aligned and inside the heap, and must
+ *    still hold its fill pattern when it is reallocated or freed.
+ */
+static int eval_mm_threads_valid(replay_t *replay, int tracenum)
+{
+    char msg[MAXLINE];
+
+    replay->check = 1;
+    replay->live = replay->peak = 0;
+    eval_mm_threads(replay);
+    replay->check = 0;
+    replay->heapsize = mem_heapsize();
+    if (replay->errors > 0) {
+	sprintf(msg, "threaded replay found %d corrupted or misplaced blocks",
+		replay->errors);
+	malloc_error(tracenum, 0, msg);
+	return 0;
+    }
+    return 1;
+}
+
+/*
+ * eval_mm_threads - Replay the trace on replay->nthreads threads. This
+ *    is the function that is timed by fsecs() in -T mode.
+ */
+static void eval_mm_threads(void *ptr)
+{
+    replay_t *replay = (replay_t *)ptr;
+    pthread_t tid[MAXTHREADS];
+    replay_arg_t args[MAXTHREADS];
+    int t;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_threads");
+    memset(replay->done, 0, replay->trace->num_ids * sizeof(int));
+
+    for (t = 0; t < replay->nthreads; t++) {
+	args[t].replay = replay;
+	args[t].tid = t;
+	if (pthread_create(&tid[t], NULL, replay_thread, &args[t]) != 0)
+	    unix_error("pthread_create failed in eval_mm_threads");
+    }
+    for (t = 0; t < replay->nthreads; t++)
+	pthread_join(tid[t], NULL);
+}
+
+/*
+ * replay_thread - Issue one thread's requests, waiting for earlier
+ *    requests on the same id, which may belong to other threads
+ */
+static void *replay_thread(void *vargp)
+{
+    replay_t *replay = ((replay_arg_t *)vargp)->replay;
+    int tid = ((replay_arg_t *)vargp)->tid;
+    trace_t *trace = replay->trace;
+    int i, j, index, size, oldsize;
+    size_t live, peak;
+    char *p, *oldp;
+
+    for (j = 0; j < replay->num_ops[tid]; j++) {
+	i = replay->ops[tid][j];
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	oldsize = 0;
+	while (__atomic_load_n(&replay->done[index], __ATOMIC_ACQUIRE) !=
+	       replay->seq[i])
+	    sched_yield();
+
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mm_malloc(size)) == NULL)
+		app_error("mm_malloc failed in replay_thread");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
 	    break;
 
-	case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[trace->ops[i].index];
-	    if ((newp = realloc(oldp, newsize)) == NULL) {
-		malloc_error(tracenum, i, "libc realloc failed");
-		unix_error("System message");
-	    }
-	    trace->blocks[trace->ops[i].index] = newp;
+	case REALLOC:
+	    oldp = trace->blocks[index];
+	    oldsize = trace->block_sizes[index];
+	    if (replay->check && oldsize > 0 &&
+		(oldp[0] != (char)index || oldp[oldsize - 1] != (char)index))
+		__atomic_add_fetch(&replay->errors, 1, __ATOMIC_RELAXED);
+	    if ((p = mm_realloc(oldp, size)) == NULL)
+		app_error("mm_realloc failed in replay_thread");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
 	    break;
-	    
-        case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
+
+	case FREE:
+	    p = trace->blocks[index];
+	    oldsize = trace->block_sizes[index];
+	    if (replay->check && oldsize > 0 &&
+		(p[0] != (char)index || p[oldsize - 1] != (char)index))
+		__atomic_add_fetch(&replay->errors, 1, __ATOMIC_RELAXED);
+	    mm_free(p);
+	    p = NULL;
 	    break;
 
 	default:
-	    app_error("invalid operation type  in eval_libc_valid");
+	    app_error("Nonexistent request type in replay_thread");
 	}
-    }
 
-    return 1;
+	/* Track the peak payload in use for the utilization of the replay */
+	if (replay->check) {
+	    live = __atomic_add_fetch(&replay->live,
+				      (p != NULL ? size : 0) - (size_t)oldsize,
+				      __ATOMIC_RELAXED);
+	    peak = __atomic_load_n(&replay->peak, __ATOMIC_RELAXED);
+	    while (live > peak &&
+		   !__atomic_compare_exchange_n(&replay->peak, &peak, live, 1,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	}
+
+	/* Check the new block and fill it with the low byte of its id */
+	if (replay->check && p != NULL && size > 0) {
+	    if (!IS_ALIGNED(p) || p < (char *)mem_heap_lo() ||
+		p + size - 1 > (char *)mem_heap_hi())
+		__atomic_add_fetch(&replay->errors, 1, __ATOMIC_RELAXED);
+	    else
+		memset(p, index & 0xFF, size);
+	}
+	__atomic_store_n(&replay->done[index], replay->seq[i] + 1,
+			 __ATOMIC_RELEASE);
+    }
+    return NULL;
 }
 
-/* 
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
- *    of traces.
+/*
+ * trace_peak - Return the index of the first request after which the
+ *    total payload of the live blocks reaches its maximum
  */
-static void eval_libc_speed(void *ptr)
+static int trace_peak(trace_t *trace)
 {
-    int i;
-    int index, size, newsize;
-    char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
+    int i, index;
+    int peak = 0;
+    long total_size = 0, max_total_size = 0;
 
     for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
-        case ALLOC: /* malloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = malloc(size)) == NULL)
-		unix_error("malloc failed in eval_libc_speed");
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    total_size += trace->ops[i].size;
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case REALLOC:
+	    total_size += trace->ops[i].size - trace->block_sizes[index];
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case FREE:
+	    total_size -= trace->block_sizes[index];
+	    break;
+	}
+	if (total_size > max_total_size) {
+	    max_total_size = total_size;
+	    peak = i;
+	}
+    }
+    return peak;
+}
+
+/*
+ * eval_mm_near - Replay the trace up to its peak, either with plain
+ *    mm_malloc or with mm_malloc_near hinted by the most recently
+ *    allocated block. Then link the live blocks in allocation order and
+ *    time walks over that chain, which is what a traversal of related
+ *    objects costs on the resulting layout.
+ */
+static int eval_mm_near(trace_t *trace, int tracenum, range_t **ranges,
+			int use_hint, near_t *near)
+{
+    int i, j, n, index, size, peak, ok = 0;
+    char *p, *oldp, *prev, *last = NULL;
+    int *order;
+    char *seen;
+    double dist = 0;
+    chase_t chase;
+
+    peak = trace_peak(trace);
+    if ((order = (int *)malloc(trace->num_ids * sizeof(int))) == NULL ||
+	(seen = (char *)calloc(trace->num_ids, 1)) == NULL)
+	unix_error("malloc failed in eval_mm_near");
+    for (i = 0; i < trace->num_ids; i++)
+	trace->blocks[i] = NULL;
+
+    /* Reset the heap and free any records in the range list */
+    mem_reset_brk();
+    clear_ranges(ranges);
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	goto out;
+    }
+
+    n = 0;
+    for (i = 0;  i <= peak;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    p = use_hint ? mm_malloc_near(last, size) : mm_malloc(size);
+	    if (p == NULL) {
+		malloc_error(tracenum, i, use_hint ? "mm_malloc_near failed." :
+			     "mm_malloc failed.");
+		goto out;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		goto out;
 	    trace->blocks[index] = p;
+	    if (!seen[index]) {
+		seen[index] = 1;
+		order[n++] = index;
+	    }
+	    last = p;
 	    break;
 
-	case REALLOC: /* realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
+	case REALLOC:
 	    oldp = trace->blocks[index];
-	    if ((newp = realloc(oldp, newsize)) == NULL)
-		unix_error("realloc failed in eval_libc_speed\n");
-	    
-	    trace->blocks[index] = newp;
+	    if ((p = mm_realloc(oldp, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_realloc failed.");
+		goto out;
+	    }
+	    remove_range(ranges, oldp);
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		goto out;
+	    trace->blocks[index] = p;
+	    if (last == oldp)
+		last = p;
 	    break;
-	    
-        case FREE: /* free */
-	    index = trace->ops[i].index;
-	    block = trace->blocks[index];
-	    free(block);
+
+	case FREE:
+	    p = trace->blocks[index];
+	    remove_range(ranges, p);
+	    mm_free(p);
+	    trace->blocks[index] = NULL;
+	    if (last == p)
+		last = NULL; /* hints must be live blocks */
 	    break;
 	}
     }
+
+    /* Chain the live blocks in the order they were allocated */
+    chase.head = prev = NULL;
+    near->nodes = 0;
+    for (j = 0; j < n; j++) {
+	if ((p = trace->blocks[order[j]]) == NULL)
+	    continue;
+	if (prev != NULL) {
+	    *(char **)prev = p;
+	    dist += (p > prev) ? p - prev : prev - p;
+	}
+	else
+	    chase.head = p;
+	prev = p;
+	near->nodes++;
+    }
+    if (prev != NULL)
+	*(char **)prev = NULL;
+    near->dist[use_hint] = (near->nodes > 1) ? dist / (near->nodes - 1) : 0;
+
+    chase.reps = CHASE_REPS;
+    near->secs[use_hint] = fsecs(eval_chase, &chase) / CHASE_REPS;
+    ok = 1;
+ out:
+    free(order);
+    free(seen);
+    return ok;
 }
 
-/*************************************
- * Some miscellaneous helper routines
- ************************************/
+/*
+ * eval_chase - Walk the chain built by eval_mm_near, timed by fsecs()
+ */
+static volatile char *chase_sink; /* keeps the walk from being optimized away */
+
+static void eval_chase(void *ptr)
+{
+    chase_t *chase = (chase_t *)ptr;
+    char *p;
+    int i;
 
+    for (i = 0; i < chase->reps; i++)
+	for (p = chase->head; p != NULL; p = *(char **)p)
+	    chase_sink = p;
+}
 
 /*
- * printresults - prints a performance summary for some malloc package
+ * eval_mm_tlb - Replay the trace up to its peak, fault in every live
+ *    block and time random reads at random blocks and offsets. With
+ *    small blocks the reads stay within a few pages; with large ones
+ *    nearly every read misses the TLB, which is what huge pages are
+ *    for. Validity has been checked already, so nothing is checked.
  */
-static void printresults(int n, stats_t *stats) 
+static int eval_mm_tlb(trace_t *trace, int tracenum, tlb_t *tlb)
 {
-    int i;
-    double secs = 0;
-    double ops = 0;
-    double util = 0;
+    int i, index, size, peak;
+    tlbwalk_t walk;
+    char *p;
 
-    /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
-    for (i=0; i < n; i++) {
-	if (stats[i].valid) {
+    peak = trace_peak(trace);
+    for (i = 0; i < trace->num_ids; i++)
+	trace->blocks[i] = NULL;
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	return 0;
+    }
+
+    for (i = 0;  i <= peak;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mm_malloc(size)) == NULL) {
+		malloc_error(tracenum, i, "mm_malloc failed.");
+		return 0;
+	    }
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+	case REALLOC:
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL) {
+		malloc_error(tracenum, i, "mm_realloc failed.");
+		return 0;
+	    }
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    trace->blocks[index] = NULL;
+	    break;
+	}
+    }
+
+    /* Collect the live blocks and fault them in */
+    if ((walk.blocks = (char **)malloc(trace->num_ids * sizeof(char *))) == NULL ||
+	(walk.sizes = (int *)malloc(trace->num_ids * sizeof(int))) == NULL)
+	unix_error("malloc failed in eval_mm_tlb");
+    walk.n = 0;
+    tlb->live = 0;
+    for (i = 0; i < trace->num_ids; i++) {
+	if ((p = trace->blocks[i]) == NULL || trace->block_sizes[i] <= 0)
+	    continue;
+	memset(p, i, trace->block_sizes[i]);
+	walk.blocks[walk.n] = p;
+	walk.sizes[walk.n++] = trace->block_sizes[i];
+	tlb->live += trace->block_sizes[i];
+    }
+    tlb->huge = huge_bytes(mem_heap_lo(), mem_heap_hi());
+
+    tlb->secs = (walk.n > 0) ? fsecs(eval_tlb_walk, &walk) : 0;
+    free(walk.blocks);
+    free(walk.sizes);
+    return 1;
+}
+
+/*
+ * eval_tlb_walk - TLB_READS random reads over the blocks collected by
+ *    eval_mm_tlb, timed by fsecs()
+ */
+static volatile char tlb_sink; /* keeps the reads from being optimized away */
+
+static void eval_tlb_walk(void *ptr)
+{
+    tlbwalk_t *walk = (tlbwalk_t *)ptr;
+    unsigned long x = 88172645463325252UL; /* xorshift64 */
+    char sum = 0;
+    int i, b;
+
+    for (i = 0; i < TLB_READS; i++) {
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	b = (x & 0xffffffff) % walk->n;
+	sum += walk->blocks[b][(x >> 32) % walk->sizes[b]];
+    }
+    tlb_sink = sum;
+}
+
+/*
+ * huge_bytes - bytes of [lo, hi] that the kernel backs with transparent
+ *    huge pages, from the AnonHugePages lines of /proc/self/smaps
+ */
+static size_t huge_bytes(void *lo, void *hi)
+{
+    char line[MAXLINE];
+    unsigned long start, end, kb;
+    int in_heap = 0;
+    size_t bytes = 0;
+    FILE *fp;
+
+    if ((fp = fopen("/proc/self/smaps", "r")) == NULL)
+	return 0;
+    while (fgets(line, MAXLINE, fp) != NULL) {
+	if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+	    in_heap = (start <= (unsigned long)hi && end > (unsigned long)lo);
+	else if (in_heap && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)
+	    bytes += kb * 1024;
+    }
+    fclose(fp);
+    return bytes;
+}
+
+/*
+ * eval_mm_oracle - Utilization of mm_malloc_class with perfect lifetime
+ *    hints. Each id's lifetime (in requests, from its first allocation
+ *    to its free) is read off the trace ahead of time and passed to
+ *    mm_malloc_class as a lifetime class. This is not a bound: every
+ *    region grows chunks of its own, and hinted small blocks carry
+ *    boundary tags instead of living in slots, which can cost more
+ *    than the segregation gains. Returns 0 if the replay was not
+ *    correct, otherwise fills in the utilization and class counts.
+ */
+static int eval_mm_oracle(trace_t *trace, int tracenum, range_t **ranges,
+			  oracle_t *oracle)
+{
+    int i, index, size, oldsize, ok = 0;
+    int total_size = 0, max_total_size = 0;
+    int *birth, *death;
+    char *cls;
+    long life;
+    char *p, *oldp;
+
+    if ((birth = (int *)malloc(trace->num_ids * sizeof(int))) == NULL ||
+	(death = (int *)malloc(trace->num_ids * sizeof(int))) == NULL ||
+	(cls = (char *)malloc(trace->num_ids)) == NULL)
+	unix_error("malloc failed in eval_mm_oracle");
+
+    /* Look ahead: lifetimes of every id, then their classes */
+    for (i = 0; i < trace->num_ids; i++)
+	birth[i] = -1, death[i] = trace->num_ops;
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	if (trace->ops[i].type == FREE)
+	    death[index] = i;
+	else if (birth[index] < 0)
+	    birth[index] = i;
+    }
+    memset(oracle->count, 0, sizeof(oracle->count));
+    for (i = 0; i < trace->num_ids; i++) {
+	life = death[i] - birth[i];
+	if (life < LIFE_SHORT_FRAC * trace->num_ops)
+	    cls[i] = MM_LIFE_SHORT;
+	else if (life >= LIFE_LONG_FRAC * trace->num_ops)
+	    cls[i] = MM_LIFE_LONG;
+	else
+	    cls[i] = MM_LIFE_MEDIUM;
+	oracle->count[(int)cls[i]]++;
+    }
+
+    /* Replay with the class hints, checking every block as we go */
+    mem_reset_brk();
+    clear_ranges(ranges);
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	goto out;
+    }
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mm_malloc_class(size, cls[index])) == NULL) {
+		malloc_error(tracenum, i, "mm_malloc_class failed.");
+		goto out;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		goto out;
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    break;
+
+	case REALLOC: /* mm_realloc keeps the block in its region */
+	    oldp = trace->blocks[index];
+	    oldsize = trace->block_sizes[index];
+	    if ((p = mm_realloc(oldp, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_realloc failed.");
+		goto out;
+	    }
+	    remove_range(ranges, oldp);
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		goto out;
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size - oldsize;
+	    break;
+
+	case FREE:
+	    p = trace->blocks[index];
+	    remove_range(ranges, p);
+	    mm_free(p);
+	    total_size -= trace->block_sizes[index];
+	    break;
+	}
+	max_total_size = (total_size > max_total_size) ?
+	    total_size : max_total_size;
+    }
+
+    oracle->util = (double)max_total_size / (double)mem_heapsize();
+    ok = 1;
+ out:
+    free(birth);
+    free(death);
+    free(cls);
+    return ok;
+}
+
+/*
+ * eval_mm_sized - Replay the trace freeing every block with
+ *    mm_free_sized and the size the trace asked for, checking every
+ *    block as we go. With 'sized' clear the thread heaps are turned off
+ *    and plain mm_free is used, so every block carries boundary tags;
+ *    with it set, small blocks are header-less slots. Returns 0 if the
+ *    replay was not correct, otherwise fills in its utilization.
+ */
+static int eval_mm_sized(trace_t *trace, int tracenum, range_t **ranges,
+			 int sized, sized_t *stats)
+{
+    int i, index, size, oldsize, depth, ok = 0;
+    long total_size = 0, max_total_size = 0;
+    char *p, *oldp;
+
+    depth = mm_set_tcache_depth(0);
+    if (sized)
+	mm_set_tcache_depth(depth);
+    mem_reset_brk();
+    clear_ranges(ranges);
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	goto out;
+    }
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mm_malloc(size)) == NULL) {
+		malloc_error(tracenum, i, "mm_malloc failed.");
+		goto out;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		goto out;
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    break;
+
+	case REALLOC:
+	    oldp = trace->blocks[index];
+	    oldsize = trace->block_sizes[index];
+	    if ((p = mm_realloc(oldp, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_realloc failed.");
+		goto out;
+	    }
+	    remove_range(ranges, oldp);
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		goto out;
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size - oldsize;
+	    break;
+
+	case FREE:
+	    p = trace->blocks[index];
+	    remove_range(ranges, p);
+	    if (sized)
+		mm_free_sized(p, trace->block_sizes[index]);
+	    else
+		mm_free(p);
+	    total_size -= trace->block_sizes[index];
+	    break;
+	}
+	if (total_size > max_total_size)
+	    max_total_size = total_size;
+    }
+
+    stats->util[sized] = (double)max_total_size / (double)mem_heapsize();
+    ok = 1;
+ out:
+    mm_set_tcache_depth(depth);
+    return ok;
+}
+
+/*
+ * eval_mm_search - Replay the trace, checking every block as we go,
+ *    and read mm_search_probes around every malloc and realloc to get
+ *    the number of blocks its fit search looked at. Requests served
+ *    without a search (slots, in-place reallocs) count as 0. Returns 0
+ *    if the replay was not correct, otherwise fills in the histogram,
+ *    the percentiles and the SEARCH_WORST longest searches.
+ */
+static int eval_mm_search(trace_t *trace, int tracenum, range_t **ranges,
+			  search_t *stats)
+{
+    int i, j, b, index, size, ok = 0;
+    unsigned long before, probes, wraps, *len;
+    char *p = NULL, *oldp;
+
+    if ((len = (unsigned long *)malloc(trace->num_ops * sizeof(*len))) == NULL)
+	unix_error("len malloc in eval_mm_search failed");
+    stats->nreqs = 0;
+    for (j = 0; j < SEARCH_WORST; j++)
+	stats->worst[j] = -1;
+
+    mem_reset_brk();
+    clear_ranges(ranges);
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	goto out;
+    }
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	before = mm_search_probes(NULL);
+
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mm_malloc(size)) == NULL) {
+		malloc_error(tracenum, i, "mm_malloc failed.");
+		goto out;
+	    }
+	    break;
+
+	case REALLOC:
+	    oldp = trace->blocks[index];
+	    if ((p = mm_realloc(oldp, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_realloc failed.");
+		goto out;
+	    }
+	    remove_range(ranges, oldp);
+	    break;
+
+	case FREE:
+	    remove_range(ranges, trace->blocks[index]);
+	    mm_free(trace->blocks[index]);
+	    continue;
+	}
+
+	if (add_range(ranges, p, size, tracenum, i) == 0)
+	    goto out;
+	trace->blocks[index] = p;
+	trace->block_sizes[index] = size;
+
+	/* Histogram bin: 0, 1, then powers of two */
+	probes = mm_search_probes(NULL) - before;
+	len[stats->nreqs++] = probes;
+	for (b = 0; probes > 0 && b < SEARCH_BINS - 1; probes >>= 1)
+	    b++;
+	stats->hist[b]++;
+
+	/* Keep the longest searches, longest first */
+	probes = len[stats->nreqs - 1];
+	for (j = SEARCH_WORST; j > 0 && (stats->worst[j-1] < 0 ||
+					 probes > stats->worst_len[j-1]); j--)
+	    if (j < SEARCH_WORST) {
+		stats->worst[j] = stats->worst[j-1];
+		stats->worst_size[j] = stats->worst_size[j-1];
+		stats->worst_len[j] = stats->worst_len[j-1];
+	    }
+	if (j < SEARCH_WORST) {
+	    stats->worst[j] = i;
+	    stats->worst_size[j] = size;
+	    stats->worst_len[j] = probes;
+	}
+    }
+
+    probes = mm_search_probes(&wraps);
+    stats->wrapped = probes ? (double)wraps / probes : 0.0;
+    if (stats->nreqs > 0) {
+	qsort(len, stats->nreqs, sizeof(*len), cmp_ulong);
+	stats->pct[0] = len[(stats->nreqs - 1) * 50 / 100];
+	stats->pct[1] = len[(stats->nreqs - 1) * 90 / 100];
+	stats->pct[2] = len[(stats->nreqs - 1) * 99 / 100];
+	stats->pct[3] = len[stats->nreqs - 1];
+    }
+    ok = 1;
+ out:
+    free(len);
+    return ok;
+}
+
+/*
+ * cmp_ulong - qsort comparison for unsigned longs, ascending
+ */
+static int cmp_ulong(const void *a, const void *b)
+{
+    unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * eval_mm_split - Replay the trace with id i in heap i % nheaps, each
+ *    heap made by mm_heap_create, checking every block as we go.
+ *    Reallocs move the block within its heap. Returns 0 if the replay
+ *    was not correct, otherwise fills in the utilization of all heaps
+ *    together and of each heap.
+ */
+static int eval_mm_split(trace_t *trace, int tracenum, range_t **ranges,
+			 int nheaps, split_t *split)
+{
+    mm_heap_t *heaps[MAXHEAPS];
+    mm_heap_stats_t hstats;
+    long total_size = 0, max_total_size = 0;
+    long live[MAXHEAPS], peak[MAXHEAPS];
+    size_t heapsize = 0;
+    int i, h, index, size, oldsize, ok = 0;
+    char *p, *oldp;
+
+    for (h = 0; h < nheaps; h++) {
+	live[h] = peak[h] = 0;
+	if ((heaps[h] = mm_heap_create(heap_reserve)) == NULL) {
+	    malloc_error(tracenum, 0, "mm_heap_create failed.");
+	    while (--h >= 0)
+		mm_heap_destroy(heaps[h]);
+	    return 0;
+	}
+    }
+    clear_ranges(ranges);
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	h = index % nheaps;
+
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mm_heap_malloc(heaps[h], size)) == NULL) {
+		malloc_error(tracenum, i, "mm_heap_malloc failed.");
+		goto out;
+	    }
+	    if (add_range_in(ranges, p, size, 0, tracenum, i) == 0)
+		goto out;
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    live[h] += size;
+	    break;
+
+	case REALLOC: /* no mm_heap_realloc: allocate, copy, free */
+	    oldp = trace->blocks[index];
+	    oldsize = trace->block_sizes[index];
+	    if ((p = mm_heap_malloc(heaps[h], size)) == NULL) {
+		malloc_error(tracenum, i, "mm_heap_malloc failed.");
+		goto out;
+	    }
+	    memcpy(p, oldp, (oldsize < size) ? oldsize : size);
+	    remove_range(ranges, oldp);
+	    mm_heap_free(heaps[h], oldp);
+	    if (add_range_in(ranges, p, size, 0, tracenum, i) == 0)
+		goto out;
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size - oldsize;
+	    live[h] += size - oldsize;
+	    break;
+
+	case FREE:
+	    p = trace->blocks[index];
+	    remove_range(ranges, p);
+	    mm_heap_free(heaps[h], p);
+	    total_size -= trace->block_sizes[index];
+	    live[h] -= trace->block_sizes[index];
+	    break;
+	}
+	max_total_size = (total_size > max_total_size) ?
+	    total_size : max_total_size;
+	peak[h] = (live[h] > peak[h]) ? live[h] : peak[h];
+    }
+
+    for (h = 0; h < nheaps; h++) {
+	mm_heap_stats(heaps[h], &hstats);
+	heapsize += hstats.heapsize;
+	split->heap_util[h] = (double)peak[h] / hstats.heapsize;
+    }
+    split->util = (double)max_total_size / heapsize;
+    ok = 1;
+
+ out:
+    for (h = 0; h < nheaps; h++)
+	mm_heap_destroy(heaps[h]);
+    return ok;
+}
+
+/*
+ * eval_libc_valid - We run this function to make sure that the
+ *    libc malloc can run to completion on the set of traces.
+ *    We'll be conservative and terminate if any libc malloc call fails.
+ *
+ */
+static int eval_libc_valid(trace_t *trace, int tracenum)
+{
+    int i, newsize;
+    char *p, *newp, *oldp;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* malloc */
+	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc malloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case REALLOC: /* realloc */
+            newsize = trace->ops[i].size;
+	    oldp = trace->blocks[trace->ops[i].index];
+	    if ((newp = realloc(oldp, newsize)) == NULL) {
+		malloc_error(tracenum, i, "libc realloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = newp;
+	    break;
+	    
+        case FREE: /* free */
+	    free(trace->blocks[trace->ops[i].index]);
+	    break;
+
+	default:
+	    app_error("invalid operation type  in eval_libc_valid");
+	}
+    }
+
+    return 1;
+}
+
+/* 
+ * eval_libc_speed - This is the function that is used by fcyc() to
+ *    measure the running time of the libc malloc package on the set
+ *    of traces.
+ */
+static void eval_libc_speed(void *ptr)
+{
+    int i;
+    int index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+        case ALLOC: /* malloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = malloc(size)) == NULL)
+		unix_error("malloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+	case REALLOC: /* realloc */
+	    index = trace->ops[i].index;
+	    newsize = trace->ops[i].size;
+	    oldp = trace->blocks[index];
+	    if ((newp = realloc(oldp, newsize)) == NULL)
+		unix_error("realloc failed in eval_libc_speed\n");
+	    
+	    trace->blocks[index] = newp;
+	    break;
+	    
+        case FREE: /* free */
+	    index = trace->ops[i].index;
+	    block = trace->blocks[index];
+	    free(block);
+	    break;
+	}
+    }
+}
+
+/*************************************
+ * Some miscellaneous helper routines
+ ************************************/
+
+
+/*
+ * printresults - prints a performance summary for some malloc package
+ */
+static void printresults(int n, stats_t *stats) 
+{
+    int i;
+    double secs = 0;
+    double ops = 0;
+    double util = 0;
+
+    /* Print the individual results for each trace */
+    printf("%5s%7s %5s%8s%10s%6s\n", 
+	   "trace", " valid", "util", "ops", "secs", "Kops");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
 	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
 		   i,
 		   "yes",
@@ -972,6 +2295,295 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printnear - prints the layout and pointer-chasing results of -n
+ */
+static void printnear(int n, near_t *near)
+{
+    int i;
+
+    printf("%5s%7s%10s%10s%10s%10s\n",
+	   "trace", "nodes", "dist", "dist", "ns/node", "ns/node");
+    printf("%12s%10s%10s%10s%10s\n", "", "malloc", "near", "malloc", "near");
+    for (i=0; i < n; i++) {
+	if (near[i].valid && near[i].nodes > 0) {
+	    printf("%2d%10d%10.0f%10.0f%10.2f%10.2f\n",
+		   i,
+		   near[i].nodes,
+		   near[i].dist[0],
+		   near[i].dist[1],
+		   near[i].secs[0]*1e9/near[i].nodes,
+		   near[i].secs[1]*1e9/near[i].nodes);
+	}
+	else {
+	    printf("%2d%10s%10s%10s%10s%10s\n", i, "-", "-", "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * minor_faults - minor page faults of the process so far
+ */
+static long minor_faults(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) < 0)
+	unix_error("getrusage failed");
+    return ru.ru_minflt;
+}
+
+/*
+ * printfaults - prints the minor faults taken and the memlib system
+ *     calls made by the checked runs (correctness and utilization) and
+ *     by the timed runs of each trace
+ */
+static void printfaults(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%10s%10s%12s%12s\n", "trace", "checked", "timed",
+	   "sys checked", "sys timed");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid)
+	    printf("%2d%13ld%10ld%12ld%12ld\n", i, stats[i].faults[0],
+		   stats[i].faults[1], stats[i].syscalls[0],
+		   stats[i].syscalls[1]);
+	else
+	    printf("%2d%13s%10s%12s%12s\n", i, "-", "-", "-", "-");
+    }
+}
+
+/*
+ * printheap - prints the mm_get_stats of each trace from -v: the free
+ *     blocks at the peak and their size histogram, the blocks looked
+ *     at per find_fit call and the coalesce calls by case
+ */
+static void printheap(int n, stats_t *stats)
+{
+    int i, b;
+    struct mm_stats *h;
+    static char *bins[MM_STATS_BINS] = {
+	"16", "32", "64", "128", "256", "512", "1K", "2K", "4K", "8K",
+	"16K", "32K", "64K", "128K", "256K", "512K+"};
+
+    printf("%5s%9s%9s%7s%12s%9s%8s%7s%7s%7s%7s\n", "trace", "alloc KB",
+	   "free KB", "nfree", "largest", "searches", "probes", "case1",
+	   "case2", "case3", "case4");
+    for (i=0; i < n; i++) {
+	h = &stats[i].heap;
+	if (!stats[i].valid) {
+	    printf("%2d%12s\n", i, "-");
+	    continue;
+	}
+	printf("%2d%12lu%9lu%7lu%12lu%9lu%8.1f%7lu%7lu%7lu%7lu\n", i,
+	       (unsigned long)h->allocated / 1024,
+	       (unsigned long)h->free / 1024, (unsigned long)h->free_blocks,
+	       (unsigned long)h->largest_free, h->searches,
+	       h->searches ? (double)h->probes / h->searches : 0.0,
+	       h->coalesce[0], h->coalesce[1], h->coalesce[2], h->coalesce[3]);
+    }
+
+    printf("\nFree blocks at the peak by size in bytes:\n%5s", "trace");
+    for (b = 0; b < MM_STATS_BINS; b++)
+	printf("%6s", bins[b]);
+    printf("\n");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%9s\n", i, "-");
+	    continue;
+	}
+	printf("%2d   ", i);
+	for (b = 0; b < MM_STATS_BINS; b++)
+	    printf("%6lu", (unsigned long)stats[i].heap.free_hist[b]);
+	printf("\n");
+    }
+}
+
+/*
+ * printtlb - prints the random-read throughput of -p with the live
+ *     payload and the part of the heap on transparent huge pages
+ */
+static void printtlb(int n, tlb_t *tlb)
+{
+    int i;
+
+    printf("%5s%12s%12s%12s\n", "trace", "live KB", "thp KB", "Mreads/s");
+    for (i=0; i < n; i++) {
+	if (tlb[i].valid && tlb[i].secs > 0) {
+	    printf("%2d%15lu%12lu%12.1f\n",
+		   i,
+		   (unsigned long)(tlb[i].live / 1024),
+		   (unsigned long)(tlb[i].huge / 1024),
+		   TLB_READS / tlb[i].secs / 1e6);
+	}
+	else {
+	    printf("%2d%15s%12s%12s\n", i, "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printsized - prints the utilization of the all-tags replay next to
+ *     the sized-free replay of -z
+ */
+static void printsized(int n, sized_t *sized)
+{
+    int i;
+
+    printf("%5s%7s%7s%7s\n", "trace", "util", "util", "gain");
+    printf("%5s%7s%7s\n", "", "tags", "sized");
+    for (i=0; i < n; i++) {
+	if (sized[i].valid)
+	    printf("%2d%9.0f%%%6.0f%%%6.0f%%\n", i,
+		   sized[i].util[0]*100.0, sized[i].util[1]*100.0,
+		   (sized[i].util[1] - sized[i].util[0])*100.0);
+	else
+	    printf("%2d%10s%7s%7s\n", i, "-", "-", "-");
+    }
+}
+
+/*
+ * printsearch - prints the fit search lengths of -s: percentiles, the
+ *     share of the search after the rover wrapped, the longest searches
+ *     as request number (trace line) and size, then the histogram
+ */
+static void printsearch(int n, search_t *search)
+{
+    int i, j, b;
+    static char *bins[SEARCH_BINS] = {
+	"0", "1", "2", "4", "8", "16", "32", "64", "128", "256", "512",
+	"1K", "2K+"};
+
+    printf("%5s%7s%6s%6s%6s%6s%7s  %s\n", "trace", "reqs", "p50", "p90",
+	   "p99", "max", "wrap", "longest: request (line) size = blocks");
+    for (i=0; i < n; i++) {
+	if (!search[i].valid) {
+	    printf("%2d%10s\n", i, "-");
+	    continue;
+	}
+	printf("%2d%10d%6lu%6lu%6lu%6lu%6.0f%% ", i, search[i].nreqs,
+	       search[i].pct[0], search[i].pct[1], search[i].pct[2],
+	       search[i].pct[3], search[i].wrapped * 100.0);
+	for (j = 0; j < SEARCH_WORST && search[i].worst[j] >= 0; j++)
+	    printf(" %d (%d) %d = %lu", search[i].worst[j],
+		   LINENUM(search[i].worst[j]), search[i].worst_size[j],
+		   search[i].worst_len[j]);
+	printf("\n");
+    }
+
+    printf("\nRequests by blocks looked at:\n%5s", "trace");
+    for (b = 0; b < SEARCH_BINS; b++)
+	printf("%6s", bins[b]);
+    printf("\n");
+    for (i=0; i < n; i++) {
+	if (!search[i].valid) {
+	    printf("%2d%9s\n", i, "-");
+	    continue;
+	}
+	printf("%2d   ", i);
+	for (b = 0; b < SEARCH_BINS; b++)
+	    printf("%6lu", search[i].hist[b]);
+	printf("\n");
+    }
+}
+
+/*
+ * printperf - prints the hardware events of -e, per operation with the
+ *     instructions per cycle, then per run of each trace in thousands
+ */
+static void printperf(int n, perf_t *perf)
+{
+    int i, e;
+    double *c;
+
+    printf("%5s", "trace");
+    for (e = 0; e < PC_EVENTS; e++)
+	printf("%10s", perfctr_name(e));
+    printf("%6s   (per op)\n", "IPC");
+    for (i=0; i < n; i++) {
+	c = perf[i].counts;
+	printf("%2d   ", i);
+	for (e = 0; e < PC_EVENTS; e++)
+	    if (perf[i].valid && c[e] >= 0)
+		printf("%10.2f", c[e] / perf[i].ops);
+	    else
+		printf("%10s", "-");
+	if (perf[i].valid && c[PC_CYCLES] > 0 && c[PC_INSTRUCTIONS] >= 0)
+	    printf("%6.2f\n", c[PC_INSTRUCTIONS] / c[PC_CYCLES]);
+	else
+	    printf("%6s\n", "-");
+    }
+
+    printf("\n%5s", "trace");
+    for (e = 0; e < PC_EVENTS; e++)
+	printf("%10s", perfctr_name(e));
+    printf("   (thousands per run)\n");
+    for (i=0; i < n; i++) {
+	c = perf[i].counts;
+	printf("%2d   ", i);
+	for (e = 0; e < PC_EVENTS; e++)
+	    if (perf[i].valid && c[e] >= 0)
+		printf("%10.0f", c[e] / 1e3);
+	    else
+		printf("%10s", "-");
+	printf("\n");
+    }
+}
+
+/*
+ * printoracle - prints the utilization of plain mm_malloc next to the
+ *     replay with oracle lifetime hints, with the number of ids in each
+ *     class. A negative gain means the regions cost more than they saved
+ */
+static void printoracle(int n, stats_t *stats, oracle_t *oracle)
+{
+    int i;
+
+    printf("%5s%7s%7s%7s%8s%8s%8s\n",
+	   "trace", "util", "util", "gain", "short", "medium", "long");
+    printf("%5s%7s%7s\n", "", "mm", "hinted");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid && oracle[i].valid) {
+	    printf("%2d%9.0f%%%6.0f%%%6.0f%%%8d%8d%8d\n",
+		   i,
+		   stats[i].util*100.0,
+		   oracle[i].util*100.0,
+		   (oracle[i].util - stats[i].util)*100.0,
+		   oracle[i].count[MM_LIFE_SHORT],
+		   oracle[i].count[MM_LIFE_MEDIUM],
+		   oracle[i].count[MM_LIFE_LONG]);
+	}
+	else {
+	    printf("%2d%10s%7s%7s%8s%8s%8s\n", i, "-", "-", "-", "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printsplit - prints the utilization of the one mm heap next to the
+ *     split replay, over all heaps and for each heap on its own
+ */
+static void printsplit(int n, int nheaps, stats_t *stats, split_t *split)
+{
+    int i, h;
+
+    printf("%5s%7s%7s  %s\n", "trace", "util", "util", "per heap");
+    printf("%5s%7s%7s\n", "", "mm", "split");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid && split[i].valid) {
+	    printf("%2d%9.0f%%%6.0f%% ", i,
+		   stats[i].util*100.0, split[i].util*100.0);
+	    for (h = 0; h < nheaps; h++)
+		printf("%5.0f%%", split[i].heap_util[h]*100.0);
+	    printf("\n");
+	}
+	else {
+	    printf("%2d%10s%7s\n", i, "-", "-");
+	}
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -999,19 +2611,61 @@ void malloc_error(int tracenum, int opnum, char *msg)
     printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
+/*
+ * parse_size - a byte count with an optional k, m or g suffix
+ */
+static size_t parse_size(char *arg)
+{
+    char *end;
+    size_t bytes = strtoul(arg, &end, 0);
+
+    switch (*end) {
+    case 'g': case 'G':
+	bytes <<= 10;
+	/* fall through */
+    case 'm': case 'M':
+	bytes <<= 10;
+	/* fall through */
+    case 'k': case 'K':
+	bytes <<= 10;
+	end++;
+    }
+    if (end == arg || *end != '\0' || bytes == 0) {
+	usage();
+	exit(1);
+    }
+    return bytes;
+}
+
 /* 
  * usage - Explain the command line arguments
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValrenoPsz] [-c <n>] [-f <file>] [-t <dir>] [-w <n>] [-T <n>] [-S <n>] [-H <size>]\n"
+	    "               [-p 4k|thp|huge] [-F none|eager|<n>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-c <n>     Cache depth of the per-thread caches (0 = off).\n");
+    fprintf(stderr, "\t-e         Count hardware events (perf_event_open) of the timed runs.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F <pf>    Prefault none, eager or <n> pages ahead; count faults\n");
+    fprintf(stderr, "\t           and memlib system calls.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H <size>  Reserve <size> bytes (k/m/g) for the heap.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-n         Compare layouts with mm_malloc_near hints.\n");
+    fprintf(stderr, "\t-o         Compare utilization with oracle lifetime hints (not a bound).\n");
+    fprintf(stderr, "\t-p <pages> Back the heap with 4k, thp or huge pages, time reads.\n");
+    fprintf(stderr, "\t-P         Per-CPU instead of per-thread heaps.\n");
+    fprintf(stderr, "\t-r         Time only the ops (mm_reset outside timing).\n");
+    fprintf(stderr, "\t-s         Measure the fit search of every malloc and realloc.\n");
+    fprintf(stderr, "\t-S <n>     Also split each trace's ids across <n> heaps.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
-    fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
+    fprintf(stderr, "\t-T <n>     Also replay each trace on <n> threads.\n");
+    fprintf(stderr, "\t-v         Print per-trace performance and heap stats.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-w <n>     Search window of mm_malloc_near in bytes.\n");
+    fprintf(stderr, "\t-z         Compare utilization with sized frees and slots vs tags.\n");
 }
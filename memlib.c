@@ -1,7 +1,36 @@
 /*
- * memlib.c - a module that simulates the memory system.  Needed because it 
- *            allows us to interleave calls from the student's malloc package 
+ * memlib.c - a module that simulates the memory system.  Needed because it
+ *            allows us to interleave calls from the student's malloc package
  *            with the system's malloc package in libc.
+ *
+ * Each simulated heap is a mem_heap_t with a break of its own. The
+ * mem_xxx functions work on the default heap set up by mem_init; the
+ * mem_xxx_h variants take the handle of a heap made by mem_create, so
+ * several allocators (or several copies of one) can each own a heap.
+ *
+ * Heaps are backed by normal pages, or by huge pages to cut TLB misses
+ * (mem_set_pages): explicit hugetlbfs pages where the system has them
+ * set aside, else 2 MB-aligned memory advised for transparent huge
+ * pages, else normal pages. mem_pages() tells which one was granted.
+ *
+ * Pages fault in when first touched, unless a prefault policy says
+ * otherwise (mem_set_prefault): all at once when the heap is made, or
+ * a fixed number of pages ahead of the break as it advances.
+ *
+ * Built with -DMEM_NATIVE, memlib stops simulating: each heap still
+ * reserves its address range, as an inaccessible mapping that holds no
+ * memory, but grows by mapping fresh pages over the reservation and
+ * shrinks by mapping the reservation back over them, so the pages go
+ * back to the system while the range stays the heap's. With -DMEM_NATIVE_BRK as well,
+ * the default heap moves the real program break instead, which only
+ * makes sense when mm is the process's malloc (libmm-native.so).
+ * Native heaps always use normal pages.
+ *
+ * mem_open maps a heap kept in a file instead. Its descriptor, break
+ * included, lives in the first page of the file, so the heap can be
+ * closed and mapped again later, at any address, as it was left.
+ * mem_create_shared lays a heap out the same way in shared memory, so
+ * that the processes forked after it share the heap and its break.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,36 +39,585 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/* The reservation is made accessible in steps of at least this many bytes */
+#define COMMIT_STEP (1 << 20)
+#define HUGE_PAGE (2 * (1 << 20)) /* when /sys does not say otherwise */
+#define MEM_MAGIC 0x6d656d6c69623031UL /* "memlib01", marks a heap file */
+
+/* Every system call made on a heap is counted for mem_syscalls() */
+#define SYSCALL(call) \
+    (__atomic_add_fetch(&mem_nsyscalls, 1, __ATOMIC_RELAXED), (call))
+
+/* A simulated heap */
+struct mem_heap {
+    char *start_brk;   /* points to first byte of heap */
+    char *brk;         /* points to last byte of heap */
+    char *max_addr;    /* largest legal heap address */
+    char *commit_end;  /* end of the accessible part of the heap */
+    char *fault_end;   /* end of the part prefaulted by memlib */
+    char *map;         /* start of the mapping */
+    size_t map_len;    /* length of the mapping */
+    size_t step;       /* commit granularity */
+    int pages;         /* MEM_PAGES_xxx granted for the mapping */
+    pthread_mutex_t commit_lock;
+    unsigned long magic; /* MEM_MAGIC in a heap file */
+    int file;          /* mapped from a file by mem_open */
+    int shared;        /* shared memory from mem_create_shared */
+    int clean;         /* the heap file was closed with mem_destroy */
+};
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_heap_t mem_default_heap = { .commit_lock = PTHREAD_MUTEX_INITIALIZER };
+static size_t mem_reserve = MAX_HEAP; /* bytes reserved by mem_init */
+static int mem_page_mode = MEM_PAGES_SMALL; /* pages asked for by new heaps */
+static int mem_prefault = MEM_PREFAULT_NONE;  /* prefault policy */
+static size_t mem_ahead;                      /* bytes prefaulted past the break */
+static unsigned long mem_nsyscalls;           /* system calls made so far */
+
+static int mem_map(mem_heap_t *h, size_t len);
+static int mem_commit(mem_heap_t *h, char *end);
+static void mem_populate(mem_heap_t *h, char *end);
+static void mem_place(mem_heap_t *h, size_t size, size_t used);
+#ifdef MEM_NATIVE
+static int mem_grow(mem_heap_t *h, char *lo, char *hi);
+static void mem_shrink(mem_heap_t *h, char *end);
+#endif
+
+/*
+ * mem_set_reserve - set how much address space mem_init reserves for the
+ *    heap (MAX_HEAP by default). Only takes effect before mem_init.
+ */
+void mem_set_reserve(size_t bytes)
+{
+    size_t page = mem_pagesize();
+
+    mem_reserve = (bytes + page - 1) & ~(page - 1);
+}
+
+/*
+ * mem_set_pages - choose the pages that back heaps reserved from now on
+ *    (MEM_PAGES_xxx). Returns the previous choice.
+ */
+int mem_set_pages(int mode)
+{
+    int old = mem_page_mode;
+
+    mem_page_mode = (mode == MEM_PAGES_THP || mode == MEM_PAGES_HUGETLB) ?
+	mode : MEM_PAGES_SMALL;
+    return old;
+}
+
+/*
+ * mem_set_prefault - choose when heap pages are faulted in:
+ *    MEM_PREFAULT_NONE on first touch, MEM_PREFAULT_EAGER all of them
+ *    when the heap is made (mem_init, mem_create), MEM_PREFAULT_AHEAD
+ *    'pages' pages ahead of the break whenever mem_sbrk moves it.
+ */
+void mem_set_prefault(int policy, size_t pages)
+{
+    mem_prefault = (policy == MEM_PREFAULT_EAGER ||
+		    policy == MEM_PREFAULT_AHEAD) ? policy : MEM_PREFAULT_NONE;
+    mem_ahead = pages * mem_pagesize();
+}
+
+/*
+ * mem_hugepagesize - the size of a huge page on this system. Read with
+ *    plain system calls, since stdio may call malloc underneath libmm.so.
+ */
+size_t mem_hugepagesize(void)
+{
+    static size_t huge;
+    char buf[32];
+    unsigned long n;
+    ssize_t len;
+    int fd;
+
+    if (huge == 0) {
+	huge = HUGE_PAGE;
+	fd = open("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size",
+		  O_RDONLY);
+	if (fd >= 0) {
+	    if ((len = read(fd, buf, sizeof(buf) - 1)) > 0) {
+		buf[len] = '\0';
+		n = strtoul(buf, NULL, 10);
+		if (n > 0 && (n & (n - 1)) == 0)
+		    huge = n;
+	    }
+	    close(fd);
+	}
+    }
+    return huge;
+}
+
+#ifdef MEM_NATIVE
+/*
+ * mem_map - native version: reserve len bytes of address space for a
+ *    heap with an inaccessible MAP_NORESERVE mapping, which costs no
+ *    memory; mem_grow maps pages over it as the heap grows. Keeping
+ *    the reservation means no other mapping of the process (thread
+ *    stacks, libc's large mallocs, other heaps) can land in the range
+ *    the heap will grow into. The default heap of a MEM_NATIVE_BRK
+ *    build starts at the page-aligned program break instead. Returns 0,
+ *    or -1 on failure.
+ */
+static int mem_map(mem_heap_t *h, size_t len)
+{
+    size_t page = mem_pagesize();
+    char *p;
+
+    h->step = COMMIT_STEP;
+    h->pages = MEM_PAGES_SMALL;
+#ifdef MEM_NATIVE_BRK
+    if (h == &mem_default_heap) {
+	char *lo;
+
+	p = (char *)sbrk(0);
+	lo = (char *)(((size_t)p + page - 1) & ~(page - 1));
+	if (lo > p && SYSCALL(sbrk(lo - p)) == (void *)-1)
+	    return -1;
+	h->map = lo;
+	h->map_len = len;
+	return 0;
+    }
+#endif
+    len = (len + page - 1) & ~(page - 1);
+    p = (char *)SYSCALL(mmap(NULL, len, PROT_NONE,
+			     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+			     -1, 0));
+    if (p == MAP_FAILED)
+	return -1;
+    h->map = p;
+    h->map_len = len;
+    return 0;
+}
+#else
+/*
+ * mem_map - reserve len bytes of address space for heap h with the
+ *    pages asked for, falling back to smaller ones. Normal and THP
+ *    mappings are inaccessible, so that a large reservation costs
+ *    nothing until mem_sbrk commits the part below the break; hugetlb
+ *    mappings reserve their pages up front, so they fail right here
+ *    rather than at a page fault. Returns 0, or -1 on failure.
+ */
+static int mem_map(mem_heap_t *h, size_t len)
+{
+    size_t huge = (mem_page_mode != MEM_PAGES_SMALL) ? mem_hugepagesize() : 0;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    char *p, *lo;
+
+    if (mem_page_mode == MEM_PAGES_HUGETLB) {
+	len = (len + huge - 1) & ~(huge - 1);
+	p = (char *)SYSCALL(mmap(NULL, len, PROT_NONE, flags | MAP_HUGETLB, -1, 0));
+	if (p != MAP_FAILED) {
+	    h->map = p;
+	    h->map_len = len;
+	    h->step = (COMMIT_STEP > huge) ? COMMIT_STEP : huge;
+	    h->pages = MEM_PAGES_HUGETLB;
+	    return 0;
+	}
+    }
+
+    if (mem_page_mode != MEM_PAGES_SMALL) {
+	/* over-reserve, then cut it down to a huge-page-aligned range */
+	len = (len + huge - 1) & ~(huge - 1);
+	p = (char *)SYSCALL(mmap(NULL, len + huge, PROT_NONE,
+				 flags | MAP_NORESERVE, -1, 0));
+	if (p == MAP_FAILED)
+	    return -1;
+	lo = (char *)(((size_t)p + huge - 1) & ~(huge - 1));
+	if (lo > p)
+	    SYSCALL(munmap(p, lo - p));
+	SYSCALL(munmap(lo + len, p + huge - lo));
+	h->map = lo;
+	h->map_len = len;
+	h->step = (COMMIT_STEP > huge) ? COMMIT_STEP : huge;
+	h->pages = (SYSCALL(madvise(lo, len, MADV_HUGEPAGE)) == 0) ?
+	    MEM_PAGES_THP : MEM_PAGES_SMALL;
+	return 0;
+    }
 
-/* 
+    p = (char *)SYSCALL(mmap(NULL, len, PROT_NONE, flags | MAP_NORESERVE,
+			     -1, 0));
+    if (p == MAP_FAILED)
+	return -1;
+    h->map = p;
+    h->map_len = len;
+    h->step = COMMIT_STEP;
+    h->pages = MEM_PAGES_SMALL;
+    return 0;
+}
+#endif /* MEM_NATIVE */
+
+/*
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    mem_heap_t *h = &mem_default_heap;
+
+    /*
+     * reserve the address space we will use to model the available VM.
+     * It is mapped rather than malloc'd so that memlib also works
+     * underneath the preloadable malloc replacement (libmm.so).
+     */
+    if (mem_map(h, mem_reserve) < 0) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
-} 
+    h->start_brk = h->map;
+    h->max_addr = h->start_brk + mem_reserve; /* max legal heap address */
+    h->commit_end = h->start_brk;             /* nothing committed yet */
+    h->fault_end = h->start_brk;              /* nor faulted in */
+    h->brk = h->start_brk;                    /* heap is empty initially */
+#ifndef MEM_NATIVE
+    if (mem_prefault == MEM_PREFAULT_EAGER)   /* native heaps: in mem_grow */
+	mem_populate(h, h->max_addr);
+#endif
+}
 
-/* 
+/*
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+#ifdef MEM_NATIVE
+    mem_shrink(&mem_default_heap, NULL);
+#else
+    SYSCALL(munmap(mem_default_heap.map, mem_default_heap.map_len));
+#endif
+}
+
+/*
+ * mem_default - the handle of the heap the mem_xxx functions work on
+ */
+mem_heap_t *mem_default(void)
+{
+    return &mem_default_heap;
+}
+
+/*
+ * mem_create - make a new, empty heap of at most 'size' bytes. The
+ *    descriptor gets a page of its own, so that the heap starts on a
+ *    huge page boundary. Returns NULL if the address space cannot be
+ *    reserved.
+ */
+mem_heap_t *mem_create(size_t size)
+{
+    size_t page = mem_pagesize();
+    mem_heap_t *h;
+
+    size = (size + page - 1) & ~(page - 1);
+    h = (mem_heap_t *)SYSCALL(mmap(NULL, sizeof(mem_heap_t),
+				   PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (h == MAP_FAILED)
+	return NULL;
+    if (mem_map(h, size) < 0) {
+	SYSCALL(munmap(h, sizeof(mem_heap_t)));
+	return NULL;
+    }
+
+    h->start_brk = h->map;
+    h->max_addr = h->start_brk + size;
+    h->commit_end = h->start_brk;
+    h->fault_end = h->start_brk;
+    h->brk = h->start_brk;
+    pthread_mutex_init(&h->commit_lock, NULL);
+#ifndef MEM_NATIVE
+    if (mem_prefault == MEM_PREFAULT_EAGER)
+	mem_populate(h, h->max_addr);
+#endif
+    return h;
+}
+
+/*
+ * mem_open - map the heap kept in file 'path', creating the file with
+ *    room for 'size' bytes if it does not exist; an existing file keeps
+ *    its size. A heap that was closed with mem_destroy comes back with
+ *    its break where it was, and its contents; one that was not (the
+ *    process died) comes back empty. Heap files use normal pages and
+ *    are committed from the start. Returns NULL on failure.
+ */
+mem_heap_t *mem_open(const char *path, size_t size)
+{
+    size_t page = mem_pagesize();
+    size_t used = 0;
+    struct stat st;
+    mem_heap_t *h;
+    int fd;
+
+    if ((fd = open(path, O_RDWR | O_CREAT, 0600)) < 0)
+	return NULL;
+    if (fstat(fd, &st) < 0) {
+	close(fd);
+	return NULL;
+    }
+    if (st.st_size == 0) {
+	size = page + ((size + page - 1) & ~(page - 1));
+	if (ftruncate(fd, size) < 0) {
+	    close(fd);
+	    return NULL;
+	}
+    }
+    else if ((size_t)st.st_size < page) {
+	close(fd);
+	errno = EINVAL;
+	return NULL;
+    }
+    else
+	size = st.st_size;
+    h = (mem_heap_t *)SYSCALL(mmap(NULL, size, PROT_READ | PROT_WRITE,
+				   MAP_SHARED, fd, 0));
+    close(fd);
+    if (h == MAP_FAILED)
+	return NULL;
+
+    if (st.st_size != 0) {
+	if (h->magic != MEM_MAGIC) {
+	    SYSCALL(munmap(h, size));
+	    errno = EINVAL;
+	    return NULL;
+	}
+	if (h->clean)
+	    used = h->brk - h->start_brk;
+    }
+
+    /* the old pointers are only good at the old address: rebuild them */
+    mem_place(h, size, used);
+    h->file = 1;
+    h->clean = 0;
+    return h;
+}
+
+/*
+ * mem_create_shared - make a new, empty heap of at most 'size' bytes in
+ *    shared memory. Processes forked afterwards see it at the same
+ *    address and share its break, so blocks carved out by one of them
+ *    are visible to all. It is committed from the start, because a
+ *    commit made by one process would not reach the others. Returns
+ *    NULL if the memory cannot be mapped.
+ */
+mem_heap_t *mem_create_shared(size_t size)
+{
+    size_t page = mem_pagesize();
+    mem_heap_t *h;
+
+    size = page + ((size + page - 1) & ~(page - 1));
+    h = (mem_heap_t *)SYSCALL(mmap(NULL, size, PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE,
+				   -1, 0));
+    if (h == MAP_FAILED)
+	return NULL;
+    mem_place(h, size, 0);
+    h->shared = 1;
+    return h;
+}
+
+/*
+ * mem_place - lay out a heap of 'size' bytes, descriptor included, in
+ *    the mapping that starts with descriptor h, with 'used' bytes below
+ *    the break. Its commit lock works across processes.
+ */
+static void mem_place(mem_heap_t *h, size_t size, size_t used)
+{
+    pthread_mutexattr_t attr;
+
+    h->map = (char *)h;
+    h->map_len = size;
+    h->step = COMMIT_STEP;
+    h->pages = MEM_PAGES_SMALL;
+    h->start_brk = h->map + mem_pagesize();
+    h->max_addr = h->map + size;
+    h->commit_end = h->max_addr;
+    h->fault_end = h->start_brk;
+    h->brk = h->start_brk + used;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&h->commit_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    h->magic = MEM_MAGIC;
+}
+
+/*
+ * mem_destroy - give a heap made by mem_create back to the system,
+ *    all of it at once. A heap from mem_open is closed instead: it is
+ *    marked clean and unmapped, and its file keeps the contents. A
+ *    shared heap is only unmapped from the calling process.
+ */
+void mem_destroy(mem_heap_t *h)
+{
+    if (h == NULL || h == &mem_default_heap)
+	return;
+    if (h->file || h->shared) {
+	if (h->file) {
+	    pthread_mutex_destroy(&h->commit_lock);
+	    h->clean = 1;
+	}
+	SYSCALL(munmap(h->map, h->map_len));
+	return;
+    }
+#ifdef MEM_NATIVE
+    mem_shrink(h, NULL);
+#else
+    SYSCALL(munmap(h->map, h->map_len));
+#endif
+    pthread_mutex_destroy(&h->commit_lock);
+    SYSCALL(munmap(h, sizeof(mem_heap_t)));
+}
+
+/*
+ * mem_commit - make the reservation accessible up to at least 'end'.
+ *    Commits only shrink when the heap is trimmed, which must not race
+ *    with mem_sbrk, so the fast path is a single load. Native heaps
+ *    grow by a quarter of their size at a time (at least a step), so
+ *    a heap of n bytes takes O(log n) system calls to build.
+ */
+static int mem_commit(mem_heap_t *h, char *end)
+{
+    char *old_end, *new_end;
+    int rc = 0;
+
+    if (end <= __atomic_load_n(&h->commit_end, __ATOMIC_ACQUIRE))
+	return 0;
+
+    pthread_mutex_lock(&h->commit_lock);
+    old_end = h->commit_end;
+    if (end > old_end) {
+#ifdef MEM_NATIVE
+	if (end < old_end + (old_end - h->start_brk) / 4)
+	    end = old_end + (old_end - h->start_brk) / 4;
+#endif
+	new_end = h->start_brk +
+	    (((size_t)(end - h->start_brk) + h->step - 1) & ~(h->step - 1));
+	if (new_end > h->max_addr)
+	    new_end = h->max_addr;
+#ifdef MEM_NATIVE
+	if (mem_grow(h, old_end, new_end) < 0)
+#else
+	if (SYSCALL(mprotect(old_end, new_end - old_end,
+			     PROT_READ | PROT_WRITE)) < 0)
+#endif
+	    rc = -1;
+	else
+	    __atomic_store_n(&h->commit_end, new_end, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&h->commit_lock);
+    return rc;
+}
+
+#ifdef MEM_NATIVE
+/*
+ * mem_grow - map fresh pages over [lo, hi) of the reservation of native
+ *    heap h. Called with the commit lock held. Returns 0, or -1 on
+ *    failure.
+ */
+static int mem_grow(mem_heap_t *h, char *lo, char *hi)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED;
+    char *p;
+
+#ifdef MEM_NATIVE_BRK
+    if (h == &mem_default_heap) {
+	if ((char *)sbrk(0) != lo) /* someone else moved the break */
+	    return -1;
+	if (SYSCALL(brk(hi)) < 0)
+	    return -1;
+#ifdef MADV_POPULATE_WRITE
+	if (mem_prefault == MEM_PREFAULT_EAGER)
+	    SYSCALL(madvise(lo, hi - lo, MADV_POPULATE_WRITE));
+#endif
+	return 0;
+    }
+#endif
+    if (lo < h->map || hi > h->map + h->map_len) /* MAP_FIXED must stay inside */
+	return -1;
+    if (mem_prefault == MEM_PREFAULT_EAGER)
+	flags |= MAP_POPULATE;
+    p = (char *)SYSCALL(mmap(lo, hi - lo, PROT_READ | PROT_WRITE, flags,
+			     -1, 0));
+    return (p == lo) ? 0 : -1;
+}
+
+/*
+ * mem_shrink - give the whole steps of native heap h that lie more than
+ *    a step above 'end' back to the system, by mapping the inaccessible
+ *    reservation back over them; the step of slack keeps a heap
+ *    hovering around one size from mapping and unmapping it over and
+ *    over. A NULL end unmaps all of it, reservation included. Must not
+ *    race with mem_sbrk on the same heap.
+ */
+static void mem_shrink(mem_heap_t *h, char *end)
+{
+    char *lo = h->start_brk;
+
+    pthread_mutex_lock(&h->commit_lock);
+    if (end != NULL)
+	lo += (((size_t)(end - h->start_brk) + h->step - 1) &
+	       ~(h->step - 1)) + h->step;
+    if (lo < h->commit_end) {
+#ifdef MEM_NATIVE_BRK
+	if (h == &mem_default_heap) {
+	    if ((char *)sbrk(0) == h->commit_end &&
+		SYSCALL(brk(lo)) == 0)
+		h->commit_end = lo;
+	}
+	else
+#endif
+	if (end == NULL || SYSCALL(mmap(lo, h->commit_end - lo, PROT_NONE,
+				  MAP_PRIVATE | MAP_ANONYMOUS |
+				  MAP_NORESERVE | MAP_FIXED, -1, 0)) == lo)
+	    h->commit_end = lo;
+	if (h->fault_end > h->commit_end)
+	    h->fault_end = h->commit_end;
+    }
+#ifdef MEM_NATIVE_BRK
+    if (h != &mem_default_heap)
+#endif
+    if (end == NULL && h->map != NULL) {
+	SYSCALL(munmap(h->map, h->map_len));
+	h->map = NULL;
+    }
+    pthread_mutex_unlock(&h->commit_lock);
+}
+#endif /* MEM_NATIVE */
+
+/*
+ * mem_populate - fault in the heap up to 'end' ahead of its first use.
+ *    MADV_POPULATE_WRITE does it in one call; older kernels get a touch
+ *    per page, an atomic no-op add so that it cannot clobber a byte some
+ *    thread has just been handed.
+ */
+static void mem_populate(mem_heap_t *h, char *end)
+{
+    size_t page = mem_pagesize();
+    char *lo, *p;
+
+    if (end > h->max_addr)
+	end = h->max_addr;
+    if (end <= __atomic_load_n(&h->fault_end, __ATOMIC_ACQUIRE) ||
+	mem_commit(h, end) < 0)
+	return;
+
+    pthread_mutex_lock(&h->commit_lock);
+    lo = (char *)((size_t)h->fault_end & ~(page - 1));
+    end = (char *)(((size_t)end + page - 1) & ~(page - 1));
+    if (end > h->fault_end) {
+#ifdef MADV_POPULATE_WRITE
+	if (SYSCALL(madvise(lo, end - lo, MADV_POPULATE_WRITE)) < 0)
+#endif
+	    for (p = lo; p < end; p += page)
+		__atomic_fetch_add(p, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->fault_end, end, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&h->commit_lock);
 }
 
 /*
@@ -47,50 +625,159 @@ void mem_deinit(void)
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_reset_brk_h(&mem_default_heap);
+}
+
+void mem_reset_brk_h(mem_heap_t *h)
+{
+    __atomic_store_n(&h->brk, h->start_brk, __ATOMIC_RELEASE);
+#ifdef MEM_NATIVE
+    if (!h->file && !h->shared)
+	mem_shrink(h, h->start_brk);
+#endif
 }
 
-/* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
+/*
+ * mem_sbrk - simple model of the sbrk function. Extends the heap
  *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    this model, the heap cannot be shrunk. The break is bumped with
+ *    compare-and-swap, so several threads (or several allocators) can
+ *    grow the heap at the same time and always get disjoint areas.
+ *    The new area is committed before the break moves over it (again
+ *    if the swap loses a race; commits up to an address are
+ *    idempotent), so a failed commit leaves the break where it was.
  */
-void *mem_sbrk(int incr)
+void *mem_sbrk(intptr_t incr)
+{
+    return mem_sbrk_h(&mem_default_heap, incr);
+}
+
+void *mem_sbrk_h(mem_heap_t *h, intptr_t incr)
 {
-    char *old_brk = mem_brk;
+    char *old_brk = __atomic_load_n(&h->brk, __ATOMIC_ACQUIRE);
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    do {
+	if ( (incr < 0) || (incr > h->max_addr - old_brk)) {
 	    errno = ENOMEM;
 	    fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	    return (void *)-1;
-    }
-    
-    mem_brk += incr;
+	}
+	if (mem_commit(h, old_brk + incr) < 0) {
+	    errno = ENOMEM;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Could not commit memory...\n");
+	    return (void *)-1;
+	}
+    } while (!__atomic_compare_exchange_n(&h->brk, &old_brk, old_brk + incr,
+					  0, __ATOMIC_ACQ_REL,
+					  __ATOMIC_ACQUIRE));
+    if (mem_prefault == MEM_PREFAULT_AHEAD)
+	mem_populate(h, old_brk + incr + mem_ahead);
     return (void *)old_brk;
 }
 
+/*
+ * mem_trim - lower the break by decr bytes and give the whole pages
+ *    above the new break back to the system (native heaps: unmap the
+ *    steps past the slack). Returns 0, or -1 if the break moved
+ *    meanwhile or would drop below the start of the heap.
+ */
+int mem_trim(size_t decr)
+{
+    return mem_trim_h(&mem_default_heap, decr);
+}
+
+int mem_trim_h(mem_heap_t *h, size_t decr)
+{
+    char *old_brk = __atomic_load_n(&h->brk, __ATOMIC_ACQUIRE);
+
+    if (decr > (size_t)(old_brk - h->start_brk) ||
+	!__atomic_compare_exchange_n(&h->brk, &old_brk, old_brk - decr,
+				     0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	return -1;
+#ifdef MEM_NATIVE
+    if (!h->file && !h->shared) {
+	mem_shrink(h, old_brk - decr);
+	return 0;
+    }
+#endif
+    mem_purge(old_brk - decr, decr);
+    return 0;
+}
+
+/*
+ * mem_purge - tell the system the whole pages in [start, start+len) of
+ *    the heap are not needed; they read back as zeros when next touched
+ */
+void mem_purge(void *start, size_t len)
+{
+    size_t page = mem_pagesize();
+    char *lo = (char *)(((size_t)start + page - 1) & ~(page - 1));
+    char *hi = (char *)(((size_t)start + len) & ~(page - 1));
+
+    if (hi > lo)
+	SYSCALL(madvise(lo, hi - lo, MADV_DONTNEED));
+}
+
+/*
+ * mem_syscalls - the number of system calls memlib has made on its
+ *    heaps so far: mappings, protection changes, advice and breaks
+ */
+unsigned long mem_syscalls(void)
+{
+    return __atomic_load_n(&mem_nsyscalls, __ATOMIC_RELAXED);
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_heap_lo_h(&mem_default_heap);
+}
+
+void *mem_heap_lo_h(mem_heap_t *h)
+{
+    return (void *)h->start_brk;
 }
 
-/* 
+/*
  * mem_heap_hi - return address of last heap byte
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_heap_hi_h(&mem_default_heap);
+}
+
+void *mem_heap_hi_h(mem_heap_t *h)
+{
+    return (void *)(__atomic_load_n(&h->brk, __ATOMIC_ACQUIRE) - 1);
 }
 
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
-size_t mem_heapsize() 
+size_t mem_heapsize()
+{
+    return mem_heapsize_h(&mem_default_heap);
+}
+
+size_t mem_heapsize_h(mem_heap_t *h)
+{
+    return (size_t)(__atomic_load_n(&h->brk, __ATOMIC_ACQUIRE) -
+		    h->start_brk);
+}
+
+/*
+ * mem_pages - the pages (MEM_PAGES_xxx) backing a heap
+ */
+int mem_pages()
+{
+    return mem_pages_h(&mem_default_heap);
+}
+
+int mem_pages_h(mem_heap_t *h)
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return h->pages;
 }
 
 /*
@@ -1,11 +1,47 @@
 #include <unistd.h>
+#include <stdint.h>
 
-void mem_init(void);               
+void mem_set_reserve(size_t bytes);
+void mem_init(void);
 void mem_deinit(void);
-void *mem_sbrk(int incr);
-void mem_reset_brk(void); 
+void *mem_sbrk(intptr_t incr);
+int mem_trim(size_t decr);
+void mem_purge(void *start, size_t len);
+void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+unsigned long mem_syscalls(void);
 
+/* Pages backing heaps reserved after mem_set_pages */
+#define MEM_PAGES_SMALL   0 /* normal pages */
+#define MEM_PAGES_THP     1 /* transparent huge pages */
+#define MEM_PAGES_HUGETLB 2 /* explicit huge pages, else THP */
+
+int mem_set_pages(int mode);
+int mem_pages(void);
+size_t mem_hugepagesize(void);
+
+/* When heap pages are faulted in (mem_set_prefault) */
+#define MEM_PREFAULT_NONE  0 /* on first touch */
+#define MEM_PREFAULT_EAGER 1 /* all when the heap is made */
+#define MEM_PREFAULT_AHEAD 2 /* a number of pages ahead of the break */
+
+void mem_set_prefault(int policy, size_t pages);
+
+/* Heap handles: the functions above work on mem_default() */
+typedef struct mem_heap mem_heap_t;
+
+mem_heap_t *mem_default(void);
+mem_heap_t *mem_create(size_t size);
+mem_heap_t *mem_open(const char *path, size_t size);
+mem_heap_t *mem_create_shared(size_t size);
+void mem_destroy(mem_heap_t *h);
+void *mem_sbrk_h(mem_heap_t *h, intptr_t incr);
+int mem_trim_h(mem_heap_t *h, size_t decr);
+void mem_reset_brk_h(mem_heap_t *h);
+void *mem_heap_lo_h(mem_heap_t *h);
+void *mem_heap_hi_h(mem_heap_t *h);
+size_t mem_heapsize_h(mem_heap_t *h);
+int mem_pages_h(mem_heap_t *h);
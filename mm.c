@@ -2,15 +2,29 @@
  * 🚀 Implicit Free List (묵시적 가용 리스트)
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
 #include <limits.h>
+#include <errno.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#if defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h> /* glibc registers rseq for every thread (2.35+) */
+#define HAVE_RSEQ 1
+#endif
+#endif
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
 
 team_t team = {
     /* Team name */
@@ -26,17 +40,39 @@ team_t team = {
 };
 
 // mm_free, coalesce, insert_node, remove_node
-#define ALIGNMENT 8
-#define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~0x7)
+#ifndef ALIGNMENT
+#define ALIGNMENT 8 /* 8 or 16; the preloadable build uses 16 like libc */
+#endif
+#define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
 #define WSIZE 4
 #define DSIZE 8
 #define CHUNKSIZE (1 << 12)
+#define NEAR_WINDOW (1 << 14) /* default mm_malloc_near search window */
+#define HUGE_BLOCK 8 /* on huge pages, blocks of this many get page aligned */
 
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
 #define PACK(size, alloc) ((size) | (alloc))
 
+/*
+ * Region tag (lifetime class from mm.h) in bits 1-2 of the header and
+ * footer. Blocks only coalesce with and are only found by requests of
+ * the same region, so each class lives in its own chunks of the heap.
+ */
+#define REGIONS 4
+#define PACK_R(size, alloc, region) ((size) | ((region) << 1) | (alloc))
+#define GET_REGION(p) ((int)((GET(p) >> 1) & 0x3))
+
+/* Adjusted block size (header + footer + alignment) for a request */
+#define ASIZE(size) ((size) <= DSIZE ? 2 * DSIZE : ALIGN((size) + DSIZE))
+
+/*
+ * Largest block a 4-byte boundary tag can describe. The heap itself may
+ * be far larger; free blocks simply stop coalescing at this size.
+ */
+#define MAX_BLOCK ((size_t)(0xffffffffU & ~(ALIGNMENT - 1)))
+
 #define GET(p) (*(unsigned int *)(p)) 
 #define PUT(p, val) (*(unsigned int *)(p) = (val))
 
@@ -48,102 +84,401 @@ team_t team = {
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp)-WSIZE)))
 #define PREV_BLKP(bp) ((char *)(bp)-GET_SIZE((char *)(bp)-DSIZE))
 
-static char *heap_listp = NULL;
-static char *find_nextp = NULL;
+/*
+ * Cache-line runs: one-page spans of the page heap carved into slots of
+ * whole cache lines, for mm_malloc_cacheline. The first line of a run
+ * is its header, so slots carry no boundary tags of their own. Requests
+ * larger than RUN_LINES are plain line-aligned blocks instead; the
+ * pagemap tells the two apart when they are freed.
+ */
+#define CACHELINE 64
+#define RUN_SIZE PAGE_SIZE
+#define RUN_LINES 8 /* largest slot in lines; bigger requests get own blocks */
+#define RUNP(p) ((run_t *)((size_t)(p) & ~(size_t)(RUN_SIZE - 1)))
+
+typedef struct run {
+    struct run *next;       /* next run of this class with a free slot */
+    struct run *prev;
+    unsigned lines;         /* slot size in cache lines */
+    unsigned nslots;        /* number of slots in the run */
+    unsigned nfree;         /* number of free slots */
+    unsigned long used;     /* bit i set = slot i is allocated */
+} run_t;
+
+/*
+ * A heap of boundary-tagged blocks in one memlib heap. The default heap
+ * behind mm_malloc is main_arena; mm_heap_create makes more of them.
+ */
+typedef struct arena {
+    mem_heap_t *mem;            /* memlib heap holding the blocks */
+    char *listp;                /* prologue block, NULL before init */
+    char *nextp[REGIONS];       /* next-fit rover of each region */
+    struct {                    /* for mm_get_stats, zeroed with the arena */
+        unsigned long searches; /* find_fit calls */
+        unsigned long probes;   /* blocks find_fit looked at */
+        unsigned long wraps;    /* ... of them after wrapping to listp */
+        unsigned long cases[4]; /* coalesce calls by case 1-4 */
+    } count;
+} arena_t;
+
+static arena_t main_arena;
+static size_t near_window = NEAR_WINDOW;
+static size_t huge_align; /* huge page size if the heap has them, else 0 */
+static run_t *runs[RUN_LINES + 1]; /* runs with free slots, per line count */
+
+/*
+ * One lock around all of the above. Every mm_* entry point that touches
+ * the shared heap takes it; the static helpers assume it is held.
+ * lock_waits counts the acquisitions that found it taken.
+ */
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long lock_waits;
+#define LOCK() do { if (pthread_mutex_trylock(&mm_lock) != 0) { \
+                        pthread_mutex_lock(&mm_lock); lock_waits++; } } while (0)
+#define UNLOCK() pthread_mutex_unlock(&mm_lock)
+
+/*
+ * Page heap. Spans are runs of pages cut from segments, page-aligned
+ * blocks of the boundary-tag heap above. Span descriptors live in
+ * mmap'd metadata, not in the pages, so span pages carry no headers at
+ * all. The radix pagemap maps every page of every span to its
+ * descriptor; that is how free and mm_usable_size classify a pointer
+ * without reading in front of it (no span = boundary-tag block). A
+ * freed span merges with free neighbours in its segment, and a segment
+ * with all pages free goes back to the boundary-tag heap.
+ */
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define SEG_PAGES 16 /* smallest segment in pages */
+#define PM_BITS 12 /* page-number bits per pagemap level (3 x 12 + 12 = 48) */
+#define PM_LEN (1 << PM_BITS)
+#define PM_MASK (PM_LEN - 1)
+#define SPAN_CHUNK (1 << 16) /* descriptors are mmap'd this many bytes at a time */
+
+typedef struct span {
+    char *start;                /* first page */
+    size_t npages;
+    char *seg;                  /* segment the span belongs to */
+    size_t segpages;
+    int in_use;                 /* 0 = on the free span list */
+    struct span *next;          /* free spans, or owner's slabs with free slots */
+    struct span *prev;
+    struct span *all;           /* every descriptor ever made */
+    /* slab state, when a thread heap cuts the span into slots */
+    struct theap *owner;
+    unsigned size;              /* slot size, 0 = not a slab */
+    unsigned nslots;            /* number of slots in the slab */
+    unsigned nfree;             /* slots on the free list */
+    void *free;                 /* free slots, linked through NEXT_CACHED */
+} span_t;
+
+static span_t ***pm_root[PM_LEN]; /* page number bits 35-24 -> 23-12 -> 11-0 */
+static span_t *free_spans;        /* free spans, in no particular order */
+static span_t *spare_spans;       /* unused descriptors */
+static span_t *all_spans;
+
+/*
+ * Thread heaps. Each thread adopts one of MAX_THEAPS static heaps and
+ * serves MM_LIFE_ANY requests up to SMALL_MAX bytes from slabs it owns:
+ * one-page spans cut into equal slots with no per-slot header.
+ *
+ * The owner allocates and frees slots without a lock, through a LIFO
+ * cache (tcache) of up to tcache_depth slots per size in front of its
+ * slabs. A free from another thread pushes the slot onto the owner's
+ * remote list with a single CAS, and the owner drains that list in its
+ * next malloc or free. mm_lock is only taken to get a slab from the
+ * heap or give an empty one back. heap_gen changes on every mm_init and
+ * mm_reset, which empties all thread heaps at once. Heaps of exited
+ * threads keep their slabs until another thread adopts them.
+ *
+ * In MM_CACHE_CPU mode the same heaps are indexed by CPU instead, so
+ * their number follows the cores rather than the threads. The CPU id
+ * comes from the thread's rseq area (sched_getcpu() without rseq) and
+ * a heap is held with a spin lock, which is nearly always uncontended
+ * since only threads on that CPU take it.
+ */
+#define SMALL_MAX 256 /* largest slot in bytes */
+#define SMALL_BINS (SMALL_MAX / DSIZE + 1)
+#define SMALL_SIZE(size) ALIGN(MAX((size), sizeof(void *)))
+#define TCACHE_DEPTH 8 /* default cached slots per size */
+#define MAX_THEAPS 128 /* threads beyond this use the shared heap */
+#define NEXT_CACHED(bp) (*(void **)(bp))
+
+typedef struct theap {
+    int in_use;                 /* adopted by a live thread */
+    int lock;                   /* held by a thread using it (MM_CACHE_CPU) */
+    unsigned long gen;          /* heap_gen the contents belong to */
+    void *remote;               /* slots freed by other threads (MPSC) */
+    void *bins[SMALL_BINS];     /* tcache: hot free slots by size / DSIZE */
+    int count[SMALL_BINS];
+    span_t *slabs[SMALL_BINS];  /* slabs with free slots by size / DSIZE */
+} theap_t;
+
+static theap_t theaps[MAX_THEAPS];
+static __thread theap_t *my_heap;
+static unsigned long heap_gen = 1;
+static int tcache_depth = TCACHE_DEPTH;
+static int cache_mode = MM_CACHE_THREAD;
+static pthread_key_t theap_key;
+static pthread_once_t theap_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Background maintenance (mm_start_maintenance). The thread wakes every
+ * period, or early once MAINT_PRESSURE empty slabs wait for it, and
+ * does what the malloc and free paths would otherwise do inline: give
+ * retired slabs back to the page heap, empty the slabs of idle thread
+ * heaps, trim the free tail of the heap through memlib and purge the
+ * pages of large free blocks. It holds mm_lock for at most MAINT_STEP
+ * spans or blocks at a time.
+ */
+#define MAINT_STEP 64
+#define MAINT_PRESSURE 16
+#define MAINT_WALK 16 /* lock holds of the purge walk per wakeup */
+#define PURGE_MIN (64 * 1024) /* free blocks from this size get purged */
+#define TRIM_PAD (128 * 1024) /* free tail the thread leaves in place */
 
-static void *extend_heap(size_t words);
-static void place(void *bp, size_t asize);
-static void *find_fit(size_t asize);
-static void *coalesce(void* bp);
+static pthread_t maint_tid;
+static pthread_mutex_t maint_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t maint_cond = PTHREAD_COND_INITIALIZER;
+static int maint_running;
+static int maint_period; /* milliseconds */
+static span_t *retired; /* empty slabs waiting for the thread (MPSC) */
+static int nretired;
+static char *maint_rover; /* where the purge walk resumes */
+
+static void *extend_heap(arena_t *a, size_t words, int region);
+static void place(arena_t *a, void *bp, size_t asize);
+static void *find_fit(arena_t *a, size_t asize, int region);
+static void *coalesce(arena_t *a, void* bp);
+static void arena_stats(arena_t *a, struct mm_stats *stats);
+static void *malloc_region(arena_t *a, size_t size, int region);
+static void shrink_block(void *bp, size_t asize);
+static size_t expand_block(arena_t *a, void *bp, size_t min, size_t max);
+static int format_arena(arena_t *a);
+static int init_heap(void);
+static int reset_heap(void);
+static void *near_block(void *hint, size_t size);
+static void *memalign_block(size_t align, size_t size);
+static void free_block(arena_t *a, void *bp);
+#ifdef DEBUG
+static void check_sized(void *bp, size_t size);
+#endif
+static theap_t *get_theap(void);
+static void put_theap(theap_t *h);
+static void sync_theap(theap_t *h);
+static int current_cpu(void);
+static void theap_key_init(void);
+static void abandon_theap(void *arg);
+static void *small_malloc(theap_t *h, size_t size);
+static void small_free(theap_t *h, span_t *slab, void *bp);
+static span_t *new_slab(theap_t *h, size_t size);
+static void slab_free(theap_t *h, span_t *slab, void *bp);
+static void drain_remote(theap_t *h);
+static span_t *pagemap_get(void *p);
+static int pagemap_set(span_t *span);
+static void pagemap_clear(span_t *span);
+static void reset_spans(void);
+static span_t *new_span_desc(void);
+static span_t *span_alloc(size_t npages);
+static void span_free(span_t *span);
+static void release_slab(span_t *slab);
+static size_t trim_heap(size_t pad);
+static void reclaim_theap(theap_t *h);
+static void maintain(void);
+static void *maint_thread(void *vargp);
 
 /* 
  * mm_init - initialize the malloc package.
  */
 int mm_init(void)
 {
-    if ((heap_listp = mem_sbrk(4 * WSIZE)) == (void *)-1)
+    int rc;
+
+    LOCK();
+    rc = init_heap();
+    UNLOCK();
+    return rc;
+}
+
+/*
+ * init_heap - lay out the prologue and epilogue and the first chunk
+ */
+static int init_heap(void)
+{
+    __atomic_add_fetch(&heap_gen, 1, __ATOMIC_RELEASE);
+    reset_spans();
+    memset(runs, 0, sizeof(runs));
+    maint_rover = NULL;
+
+    main_arena.mem = mem_default();
+    huge_align = (mem_pages() != MEM_PAGES_SMALL) ? mem_hugepagesize() : 0;
+    return format_arena(&main_arena);
+}
+
+/*
+ * format_arena - lay out the prologue, the epilogue and the first chunk
+ *     at the break of the arena's memlib heap
+ */
+static int format_arena(arena_t *a)
+{
+    char *listp;
+
+    memset(a->nextp, 0, sizeof(a->nextp));
+    memset(&a->count, 0, sizeof(a->count));
+    if ((listp = mem_sbrk_h(a->mem, 4 * WSIZE)) == (void *)-1)
         return -1;
-    PUT(heap_listp, 0); // Alignment padding -> Unused Block
-    PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1)); // Prologue header 
-    PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1)); // Prologue footer 
-    PUT(heap_listp + (3 * WSIZE), PACK(0, 1)); // Epilogue header
+    PUT(listp, 0); // Alignment padding -> Unused Block
+    PUT(listp + (1 * WSIZE), PACK(DSIZE, 1)); // Prologue header 
+    PUT(listp + (2 * WSIZE), PACK(DSIZE, 1)); // Prologue footer 
+    PUT(listp + (3 * WSIZE), PACK(0, 1)); // Epilogue header
     
-    heap_listp += (2 * WSIZE);
+    a->listp = listp + (2 * WSIZE);
 
-    if(extend_heap(CHUNKSIZE / WSIZE) == NULL)
+    if(extend_heap(a, CHUNKSIZE / WSIZE, MM_LIFE_ANY) == NULL)
         return -1;
 
-    if (extend_heap(4) == NULL)                  
+    if (extend_heap(a, 4, MM_LIFE_ANY) == NULL)                  
         return -1;
     return 0;
 }
 
 /*
- * extend_heap - Extends the heap with a new free block of at least 'words' words.
- * Returns a pointer to the new block or NULL on failure.
+ * mm_reset - Return the allocator to an empty state without giving the
+ *     heap back. Everything between the prologue and the epilogue becomes
+ *     one large free block, so a warm heap can be reused across batches.
+ *     Falls back to mm_init when there is no heap to reuse.
+ */
+int mm_reset(void)
+{
+    int rc;
+
+    LOCK();
+    rc = reset_heap();
+    UNLOCK();
+    return rc;
+}
+
+static int reset_heap(void)
+{
+    char *bp;
+    size_t size, chunk;
+
+    // mem_reset_brk()로 힙이 비워졌다면 처음부터 다시 초기화
+    if (main_arena.listp == NULL || mem_heapsize() < 4 * WSIZE ||
+        main_arena.listp != (char *)mem_heap_lo() + 2 * WSIZE)
+        return init_heap();
+
+    bp = main_arena.listp + DSIZE;
+    size = (char *)mem_heap_hi() + 1 - bp;
+    __atomic_add_fetch(&heap_gen, 1, __ATOMIC_RELEASE);
+    reset_spans();
+    memset(main_arena.nextp, 0, sizeof(main_arena.nextp));
+    memset(&main_arena.count, 0, sizeof(main_arena.count));
+    memset(runs, 0, sizeof(runs));
+
+    // 경계 태그에 담기지 않는 큰 힙은 MAX_BLOCK 이하의 블록 여러 개로
+    while (size > MAX_BLOCK) {
+        chunk = MIN(MAX_BLOCK, size - 2 * DSIZE) & ~(size_t)(ALIGNMENT - 1);
+        PUT(HDRP(bp), PACK(chunk, 0));
+        PUT(FTRP(bp), PACK(chunk, 0));
+        bp = NEXT_BLKP(bp);
+        size -= chunk;
+    }
+    if (size == 0) {
+        PUT(HDRP(bp), PACK(0, 1)); // Epilogue header
+        return 0;
+    }
+
+    PUT(HDRP(bp), PACK(size, 0));
+    PUT(FTRP(bp), PACK(size, 0));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); // Epilogue header
+    return 0;
+}
+
+/*
+ * extend_heap - Extends the heap with a new free block of at least 'words' words,
+ * tagged with 'region'. Returns a pointer to the new block or NULL on failure.
  */
 
-static void *extend_heap(size_t words)
+static void *extend_heap(arena_t *a, size_t words, int region)
 {
     char *bp;
     size_t size;
 
-    // size는 총 할당 free block을 의미한다
+    // size는 총 할당 free block을 의미한다 (ALIGNMENT의 배수)
     // bp = 이전 brk를 가리키고 있다
-    size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
-    if ((long)(bp = mem_sbrk(size)) == -1)
+    size = ALIGN(words * WSIZE);
+    if ((long)(bp = mem_sbrk_h(a->mem, size)) == -1)
         return NULL;
     
     // bp를 -WSIZE만큼 이동하면, epilogue block이 나오고, 이를 가용 가능(free)block으로 할당한다
     // FTRP(bp), PACK(size, 0)을 통해서, footer block 또한 생성한다
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
+    PUT(HDRP(bp), PACK_R(size, 0, region));
+    PUT(FTRP(bp), PACK_R(size, 0, region));
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));
 
-    return coalesce(bp);
+    return coalesce(a, bp);
 }
 
 
 /* 가용 블록 연결하기 */
-static void *coalesce(void *bp)
+static void *coalesce(arena_t *a, void *bp)
 {
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp))); 
-    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp))); 
+    int region = GET_REGION(HDRP(bp));
+    // 다른 region의 가용 블록은 할당된 블록처럼 취급한다
+    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp))) ||
+                        GET_REGION(FTRP(PREV_BLKP(bp))) != region;
+    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp))) ||
+                        GET_REGION(HDRP(NEXT_BLKP(bp))) != region;
     size_t size = GET_SIZE(HDRP(bp));                   
 
+    // 합친 크기가 경계 태그에 담기지 않으면 그 이웃과는 합치지 않는다
+    if (!prev_alloc && size + GET_SIZE(FTRP(PREV_BLKP(bp))) > MAX_BLOCK)
+        prev_alloc = 1;
+    if (!next_alloc && size + GET_SIZE(HDRP(NEXT_BLKP(bp))) +
+        (prev_alloc ? 0 : GET_SIZE(FTRP(PREV_BLKP(bp)))) > MAX_BLOCK)
+        next_alloc = 1;
+
     // Case 1. 이전 블록, 다음 블록 모두 할당된 상태
     if (prev_alloc && next_alloc)
     {
+        a->count.cases[0]++;
         return bp; 
     }
 
     // Case 2. 이전 블록은 할당된 상태, 다음 블록은 가용한 상태
     else if (prev_alloc && !next_alloc)
     {
+        a->count.cases[1]++;
         size += GET_SIZE(HDRP(NEXT_BLKP(bp))); 
-        PUT(HDRP(bp), PACK(size, 0));          
-        PUT(FTRP(bp), PACK(size, 0));          
+        PUT(HDRP(bp), PACK_R(size, 0, region));
+        PUT(FTRP(bp), PACK_R(size, 0, region));
     }
 
     // Case 3. 이전 블록은 가용한 상태, 다음 불록은 할당된 상태
     else if (!prev_alloc && next_alloc)
     {
+        a->count.cases[2]++;
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-        PUT(FTRP(bp), PACK(size, 0));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0)); 
+        PUT(FTRP(bp), PACK_R(size, 0, region));
+        PUT(HDRP(PREV_BLKP(bp)), PACK_R(size, 0, region));
         bp = PREV_BLKP(bp);
     }
 
     // Case 4. 이전 블록, 다음 블록 모두 가용한 상태
     else
     {
+        a->count.cases[3]++;
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(bp)), PACK_R(size, 0, region));
+        PUT(FTRP(NEXT_BLKP(bp)), PACK_R(size, 0, region));
         bp = PREV_BLKP(bp);
     }
 
-    find_nextp = bp;
+    a->nextp[region] = bp;
+    // 정리 스레드의 탐색 위치가 합쳐진 블록 안이면 블록 시작으로
+    if (maint_rover > (char *)bp && maint_rover < NEXT_BLKP(bp))
+        maint_rover = bp;
 
     return bp;
 }
@@ -155,155 +490,1697 @@ static void *coalesce(void *bp)
  */
 
 void *mm_malloc(size_t size)
+{
+    theap_t *h;
+    void *bp;
+
+    // 작은 블록은 스레드 힙의 slab에서 락 없이 꺼낸다
+    if (size > 0 && size <= SMALL_MAX && (h = get_theap()) != NULL) {
+        bp = small_malloc(h, SMALL_SIZE(size));
+        put_theap(h);
+        return bp;
+    }
+
+    // huge page 힙에서 큰 블록은 huge page 경계에 맞춘다 (앞쪽 gap은 가용 블록)
+    if (huge_align != 0 && size >= HUGE_BLOCK * huge_align)
+        return mm_memalign(huge_align, size);
+
+    LOCK();
+    bp = malloc_region(&main_arena, size, MM_LIFE_ANY);
+    UNLOCK();
+    return bp;
+}
+
+/*
+ * mm_malloc_class - Allocate a block from the region of lifetime class
+ *     'cls' (MM_LIFE_* in mm.h), so that objects expected to die together
+ *     do not fragment the chunks holding long-lived ones.
+ */
+void *mm_malloc_class(size_t size, int cls)
+{
+    void *bp;
+
+    if (cls <= MM_LIFE_ANY || cls >= REGIONS)
+        return mm_malloc(size);
+    LOCK();
+    bp = malloc_region(&main_arena, size, cls);
+    UNLOCK();
+    return bp;
+}
+
+/*
+ * malloc_region - next-fit within one region, growing the heap by a new
+ *     chunk of that region when nothing fits
+ */
+static void *malloc_region(arena_t *a, size_t size, int region)
 {
     size_t asize, extendsize;
     char *bp;
 
-    if (size <= 0)
+    if (size <= 0 || size > MAX_BLOCK - 2 * DSIZE)
         return NULL;
     
-    if (size <= DSIZE)
-        asize = 2 * DSIZE;
-    else
-        asize = ALIGN(size + DSIZE);
+    asize = ASIZE(size);
         
-    if ((bp = find_fit(asize)) != NULL) {
-        place(bp, asize);
+    if ((bp = find_fit(a, asize, region)) != NULL) {
+        place(a, bp, asize);
         return bp;
     }
 
     extendsize = MAX(CHUNKSIZE, asize);
     
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
+    if ((bp = extend_heap(a, extendsize/WSIZE, region)) == NULL)
         return NULL;
     
-    place(bp, asize);
+    place(a, bp, asize);
     return bp;
 }
 
 
 /*
- * mm_free - Freeing a block does nothing.
+ * mm_malloc_near - Allocate a block at or after the block of 'hint',
+ *     looking no further than the near window past it, so that objects
+ *     which are traversed together end up next to each other. 'hint'
+ *     must be a block that is still allocated (or NULL). Falls back to
+ *     the normal next-fit placement when nothing in the window fits.
  */
-void mm_free(void *bp)
+void *mm_malloc_near(void *hint, size_t size)
 {
-    size_t size = GET_SIZE(HDRP(bp));
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
-    coalesce(bp);
-}
+    void *bp;
 
-/*
- * find_fit - function for the simple allocator described in Section 9.9.12
- * My solution should perform a first-fit search of the impliticit free list
- */
+    // slab의 slot 뒤에는 이웃 블록이 없다
+    if (hint == NULL || pagemap_get(hint) != NULL)
+        return mm_malloc(size);
+    LOCK();
+    bp = near_block(hint, size);
+    UNLOCK();
+    return bp;
+}
 
-static void *find_fit(size_t asize)
+static void *near_block(void *hint, size_t size)
 {
-    // /* First-fit search*/
-    // char* bp;
+    size_t asize;
+    char *bp, *limit;
+    int region;
 
-    // for(bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
-    // {
-    //     if(!GET_ALLOC(HDRP(bp)) && (asize <= GET_SIZE(HDRP(bp))))
-    //         return bp;
-    // }
+    if (size <= 0 || size > MAX_BLOCK - 2 * DSIZE)
+        return NULL;
 
-    // Next-fit
-    char *bp;
-    if (find_nextp == NULL)
-        find_nextp = heap_listp;
-    
-    // 현재 위치부터 끝까지 탐색
-    for (bp = find_nextp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+    asize = ASIZE(size);
+    limit = (char *)hint + near_window;
+    region = GET_REGION(HDRP(hint));
+
+    // hint 블록부터 window 범위 안에서 first-fit
+    for (bp = hint; GET_SIZE(HDRP(bp)) > 0 && bp <= limit; bp = NEXT_BLKP(bp))
     {
-        if (!GET_ALLOC(HDRP(bp)) && (asize <= GET_SIZE(HDRP(bp))))
+        if (!GET_ALLOC(HDRP(bp)) && GET_REGION(HDRP(bp)) == region &&
+            (asize <= GET_SIZE(HDRP(bp))))
         {
-            find_nextp = NEXT_BLKP(bp);  // 다음 탐색을 위해 업데이트
+            place(&main_arena, bp, asize);
             return bp;
         }
     }
-    
-    // 처음부터 시작점까지 탐색
-    for (bp = heap_listp; bp < find_nextp; bp = NEXT_BLKP(bp))
-    {
-        if (!GET_ALLOC(HDRP(bp)) && (asize <= GET_SIZE(HDRP(bp))))
-        {
-            find_nextp = NEXT_BLKP(bp);  // 다음 탐색을 위해 업데이트
-            return bp;
-        }
+
+    return malloc_region(&main_arena, size, region);
+}
+
+/*
+ * mm_set_near_window - Set how many bytes past the hint mm_malloc_near
+ *     may search. Returns the previous window.
+ */
+size_t mm_set_near_window(size_t bytes)
+{
+    size_t old;
+
+    LOCK();
+    old = near_window;
+    near_window = bytes;
+    UNLOCK();
+    return old;
+}
+
+/*
+ * mm_memalign - Allocate a block whose payload is aligned to 'align', a
+ *     power of two. Over-allocates, gives the unaligned front back as a
+ *     free block and trims the unused tail.
+ */
+void *mm_memalign(size_t align, size_t size)
+{
+    void *bp;
+
+    LOCK();
+    bp = memalign_block(align, size);
+    UNLOCK();
+    return bp;
+}
+
+static void *memalign_block(size_t align, size_t size)
+{
+    char *bp, *p;
+    size_t bsize, gap;
+    int region;
+
+    if (align <= ALIGNMENT)
+        return malloc_region(&main_arena, size, MM_LIFE_ANY);
+    if (size <= 0 || (align & (align - 1)) != 0 || align > MAX_BLOCK)
+        return NULL;
+    if ((bp = malloc_region(&main_arena, size + align + 2 * DSIZE, MM_LIFE_ANY)) == NULL)
+        return NULL;
+
+    // 앞쪽 gap은 최소 블록 크기(2 * DSIZE) 이상이어야 가용 블록이 된다
+    if (((size_t)bp & (align - 1)) == 0)
+        p = bp;
+    else
+        p = (char *)(((size_t)bp + 2 * DSIZE + align - 1) & ~(align - 1));
+
+    if (p != bp) {
+        bsize = GET_SIZE(HDRP(bp));
+        region = GET_REGION(HDRP(bp));
+        gap = p - bp;
+        PUT(HDRP(bp), PACK_R(gap, 1, region));
+        PUT(FTRP(bp), PACK_R(gap, 1, region));
+        PUT(HDRP(p), PACK_R(bsize - gap, 1, region));
+        PUT(FTRP(p), PACK_R(bsize - gap, 1, region));
+        free_block(&main_arena, bp);
     }
-    
+    shrink_block(p, ASIZE(size));
+    return p;
+}
 
-    // // Best-fit
-    // char *bp, *min_bp = NULL;
-    // size_t min_size = SIZE_MAX;
+/*
+ * shrink_block - Split the unused tail off an allocated block and free
+ *     it, if the tail is big enough to be a block of its own.
+ */
+static void shrink_block(void *bp, size_t asize)
+{
+    size_t bsize = GET_SIZE(HDRP(bp));
+    int region = GET_REGION(HDRP(bp));
+    char *tail;
 
-    // for(bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
-    // {
-    //     if (GET_SIZE(HDRP(bp)) < min_size && !GET_ALLOC(HDRP(bp)) && (asize <= GET_SIZE(HDRP(bp))))
-    //     {
-    //         min_size = GET_SIZE(HDRP(bp));
-    //         min_bp = bp;
-    //     }
-    // }
-    // return min_bp;
+    if (bsize - asize < 2 * DSIZE)
+        return;
+
+    PUT(HDRP(bp), PACK_R(asize, 1, region));
+    PUT(FTRP(bp), PACK_R(asize, 1, region));
+    tail = NEXT_BLKP(bp);
+    PUT(HDRP(tail), PACK_R(bsize - asize, 0, region));
+    PUT(FTRP(tail), PACK_R(bsize - asize, 0, region));
+    coalesce(&main_arena, tail);
 }
 
 /*
- * place - My function should place the reqeusted block at the beginning of the free block,
- * splitting only if the size of the remainder would equal or exceed the minimum block size
- * 
+ * mm_free - Freeing a block does nothing.
  */
+void mm_free(void *bp)
+{
+    span_t *slab = pagemap_get(bp);
+    theap_t *h;
+
+    // 헤더를 읽지 않고 pagemap으로 slot인지 가린다
+    if (slab != NULL) {
+        // 스레드 모드에서는 새 힙을 입양하지 않는다
+        h = (cache_mode == MM_CACHE_CPU) ? get_theap() : my_heap;
+        small_free(h, slab, bp);
+        put_theap(h);
+        return;
+    }
 
-static void place(void *bp, size_t asize)
+    LOCK();
+    free_block(&main_arena, bp);
+    UNLOCK();
+}
+
+/*
+ * mm_free_sized - Free a block whose requested size the caller knows.
+ *     Only blocks up to SMALL_MAX can be header-less slots, so larger
+ *     ones go straight to the boundary-tag heap without a pagemap
+ *     lookup. Built with -DDEBUG, the size is checked against the block
+ *     first and a mismatch aborts.
+ */
+void mm_free_sized(void *bp, size_t size)
 {
-    size_t fsize = GET_SIZE(HDRP(bp));
+    span_t *slab;
+    theap_t *h;
 
-    if((fsize - asize) >= (2 * DSIZE)) {
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));        
-        bp = NEXT_BLKP(bp);
-        PUT(HDRP(bp), PACK(fsize - asize, 0));
-        PUT(FTRP(bp), PACK(fsize - asize, 0));
-    } else {
-        PUT(HDRP(bp), PACK(fsize, 1));
-        PUT(FTRP(bp), PACK(fsize, 1));
+    if (bp == NULL)
+        return;
+#ifdef DEBUG
+    check_sized(bp, size);
+#endif
+    if (size <= SMALL_MAX && (slab = pagemap_get(bp)) != NULL) {
+        h = (cache_mode == MM_CACHE_CPU) ? get_theap() : my_heap;
+        small_free(h, slab, bp);
+        put_theap(h);
+        return;
     }
-    find_nextp = bp;
+
+    LOCK();
+    free_block(&main_arena, bp);
+    UNLOCK();
 }
 
+#ifdef DEBUG
 /*
- * mm_realloc - 기존에 할당된 메모리 블록의 사이즈 변경
- * 새로 할당 받은 메모리 블록에는 기존 메모리 블록의 데이터가 복사되어 들어가야 함
+ * check_sized - Abort unless 'size' could have been asked for when the
+ *     block at 'bp' was allocated: the slot size or the boundary tag
+ *     must be the one that request gets, give or take a split
  */
-void *mm_realloc(void *bp, size_t size)
+static void check_sized(void *bp, size_t size)
 {
-    void *old_bp = bp;
-    void *new_bp = bp;
-    size_t copy_size;
+    span_t *slab = pagemap_get(bp);
+    size_t bsize;
 
-    // size가 0인 경우 메모리 반환만 수행
-    if (size <= 0)
-    {
-        mm_free(bp);
-        return 0;
+    if (slab != NULL) {
+        if (size <= SMALL_MAX && SMALL_SIZE(size) == slab->size)
+            return;
+        fprintf(stderr, "mm_free_sized: %p is a %u-byte slot, freed as %lu\n",
+                bp, slab->size, (unsigned long)size);
+        abort();
     }
+    bsize = GET_SIZE(HDRP(bp));
+    if (GET_ALLOC(HDRP(bp)) && size > 0 && size <= bsize - DSIZE &&
+        bsize < ASIZE(size) + 2 * DSIZE)
+        return;
+    fprintf(stderr, "mm_free_sized: %p is a %lu-byte %s block, freed as %lu\n",
+            bp, (unsigned long)bsize, GET_ALLOC(HDRP(bp)) ? "allocated" : "free",
+            (unsigned long)size);
+    abort();
+}
+#endif
 
-    // 새로운 메모리 블록 할당하기
-    new_bp = mm_malloc(size);
-    if (new_bp == NULL)
+static void free_block(arena_t *a, void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    int region = GET_REGION(HDRP(bp));
+    PUT(HDRP(bp), PACK_R(size, 0, region));
+    PUT(FTRP(bp), PACK_R(size, 0, region));
+    coalesce(a, bp);
+}
+
+/*
+ * get_theap - The heap the calling thread should use, synced with the
+ *     current heap generation. In thread mode it is adopted on first use
+ *     and NULL if all heaps are taken; in CPU mode it is the heap of the
+ *     current CPU, locked until put_theap. NULL if thread heaps are off.
+ */
+static theap_t *get_theap(void)
+{
+    theap_t *h = my_heap;
+    int i;
+
+    if (tcache_depth == 0)
         return NULL;
 
-    // 기존 데이터 복사
-    copy_size = GET(HDRP(old_bp)) - DSIZE;
-    if (size < copy_size)
-        copy_size = size;
-    memcpy(new_bp, old_bp, copy_size);
+    if (cache_mode == MM_CACHE_CPU) {
+        h = &theaps[current_cpu() % MAX_THEAPS];
+        while (__atomic_exchange_n(&h->lock, 1, __ATOMIC_ACQUIRE))
+            sched_yield(); // 주인 스레드가 선점당했을 수 있다
+        sync_theap(h);
+        return h;
+    }
 
-    // 이전 메모리 블록 해제
-    mm_free(old_bp);
+    if (h == NULL) {
+        for (i = 0; i < MAX_THEAPS; i++)
+            if (!__atomic_load_n(&theaps[i].in_use, __ATOMIC_RELAXED) &&
+                !__atomic_exchange_n(&theaps[i].in_use, 1, __ATOMIC_ACQUIRE))
+                break;
+        if (i == MAX_THEAPS)
+            return NULL;
+        h = my_heap = &theaps[i];
+        pthread_once(&theap_once, theap_key_init);
+        pthread_setspecific(theap_key, h);
+    }
+    sync_theap(h);
+    return h;
+}
 
-    return new_bp;
+/*
+ * put_theap - Done with a heap from get_theap (unlocks it in CPU mode)
+ */
+static void put_theap(theap_t *h)
+{
+    if (h != NULL && cache_mode == MM_CACHE_CPU)
+        __atomic_store_n(&h->lock, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * sync_theap - Empty a heap whose slabs belong to an earlier generation
+ */
+static void sync_theap(theap_t *h)
+{
+    unsigned long gen = __atomic_load_n(&heap_gen, __ATOMIC_ACQUIRE);
+
+    if (h->gen != gen) { // 이전 힙의 slab이므로 버린다
+        memset(h->bins, 0, sizeof(h->bins));
+        memset(h->count, 0, sizeof(h->count));
+        memset(h->slabs, 0, sizeof(h->slabs));
+        h->remote = NULL;
+        h->gen = gen;
+    }
+}
+
+/*
+ * current_cpu - The CPU the calling thread is running on. It may move
+ *     right after; callers only use it to pick a heap.
+ */
+static int current_cpu(void)
+{
+    int cpu;
+
+#ifdef HAVE_RSEQ
+    if (__rseq_size > 0) {
+        cpu = ((volatile struct rseq *)((char *)__builtin_thread_pointer() +
+                                        __rseq_offset))->cpu_id;
+        if (cpu >= 0)
+            return cpu;
+    }
+#endif
+    cpu = sched_getcpu();
+    return cpu < 0 ? 0 : cpu;
+}
+
+/*
+ * theap_key_init - Create the key whose destructor gives up the heap of
+ *     an exiting thread
+ */
+static void theap_key_init(void)
+{
+    pthread_key_create(&theap_key, abandon_theap);
+}
+
+/*
+ * abandon_theap - Thread exit: put the cached slots back into their
+ *     slabs and leave the heap for the next thread to adopt. Slots still
+ *     in use elsewhere keep arriving on its remote list meanwhile.
+ */
+static void abandon_theap(void *arg)
+{
+    theap_t *h = arg;
+    char *bp;
+    int bin;
+
+    // 그 사이 CPU 모드로 바뀌었다면 세대도 바뀌었으므로 건드리지 않는다
+    if (h->gen == __atomic_load_n(&heap_gen, __ATOMIC_ACQUIRE)) {
+        for (bin = 0; bin < SMALL_BINS; bin++)
+            while ((bp = h->bins[bin]) != NULL) {
+                h->bins[bin] = NEXT_CACHED(bp);
+                slab_free(h, pagemap_get(bp), bp);
+            }
+        memset(h->count, 0, sizeof(h->count));
+        drain_remote(h);
+    }
+    my_heap = NULL;
+    __atomic_store_n(&h->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * small_malloc - Allocate a 'size' slot: from the tcache if possible,
+ *     else refill half the tcache bin from the thread's slabs
+ */
+static void *small_malloc(theap_t *h, size_t size)
+{
+    int n, bin = size / DSIZE;
+    span_t *slab;
+    char *bp, *p;
+
+    if ((bp = h->bins[bin]) != NULL) {
+        h->bins[bin] = NEXT_CACHED(bp);
+        h->count[bin]--;
+        return bp;
+    }
+    if (__atomic_load_n(&h->remote, __ATOMIC_RELAXED) != NULL)
+        drain_remote(h);
+
+    bp = NULL;
+    for (n = 0; n <= tcache_depth / 2; n++) {
+        if ((slab = h->slabs[bin]) == NULL) {
+            if (bp != NULL)
+                break;
+            if ((slab = new_slab(h, size)) == NULL)
+                return NULL;
+        }
+        p = slab->free;
+        slab->free = NEXT_CACHED(p);
+        if (--slab->nfree == 0) { // 가득 찬 slab은 리스트에서 뺀다
+            h->slabs[bin] = slab->next;
+            if (slab->next != NULL)
+                slab->next->prev = NULL;
+        }
+        if (bp == NULL)
+            bp = p;
+        else {
+            NEXT_CACHED(p) = h->bins[bin];
+            h->bins[bin] = p;
+            h->count[bin]++;
+        }
+    }
+    return bp;
 }
 
+/*
+ * small_free - Free a slot: into the tcache when 'h', the caller's heap
+ *     (or NULL), owns it, onto the owner's remote list otherwise
+ */
+static void small_free(theap_t *h, span_t *slab, void *bp)
+{
+    void *head;
+    int bin;
+
+    if (slab->owner != h) {
+        h = slab->owner;
+        head = __atomic_load_n(&h->remote, __ATOMIC_RELAXED);
+        do
+            NEXT_CACHED(bp) = head;
+        while (!__atomic_compare_exchange_n(&h->remote, &head, bp, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        return;
+    }
+
+    if (__atomic_load_n(&h->remote, __ATOMIC_RELAXED) != NULL)
+        drain_remote(h);
+    bin = slab->size / DSIZE;
+    NEXT_CACHED(bp) = h->bins[bin];
+    h->bins[bin] = bp;
+    if (++h->count[bin] > tcache_depth) // 절반을 slab으로 돌려보낸다
+        while (h->count[bin] > tcache_depth / 2) {
+            bp = h->bins[bin];
+            h->bins[bin] = NEXT_CACHED(bp);
+            h->count[bin]--;
+            slab_free(h, pagemap_get(bp), bp);
+        }
+}
+
+/*
+ * new_slab - Get a one-page span from the page heap and cut it into
+ *     'size' slots for thread heap 'h'
+ */
+static span_t *new_slab(theap_t *h, size_t size)
+{
+    span_t *slab;
+    char *bp;
+    int i;
+
+    LOCK();
+    slab = span_alloc(1);
+    UNLOCK();
+    if (slab == NULL)
+        return NULL;
+
+    slab->owner = h;
+    slab->size = size;
+    slab->nslots = PAGE_SIZE / size;
+    slab->nfree = slab->nslots;
+    slab->free = NULL;
+    for (i = slab->nslots - 1; i >= 0; i--) {
+        bp = slab->start + i * size;
+        NEXT_CACHED(bp) = slab->free;
+        slab->free = bp;
+    }
+    slab->prev = NULL;
+    slab->next = h->slabs[size / DSIZE];
+    if (slab->next != NULL)
+        slab->next->prev = slab;
+    h->slabs[size / DSIZE] = slab;
+    return slab;
+}
+
+/*
+ * slab_free - Put a slot back into its slab, which 'h' owns. A slab
+ *     whose slots are all free goes back to the shared heap, unless it
+ *     is the only one left for its size.
+ */
+static void slab_free(theap_t *h, span_t *slab, void *bp)
+{
+    int bin = slab->size / DSIZE;
+
+    NEXT_CACHED(bp) = slab->free;
+    slab->free = bp;
+    if (slab->nfree++ == 0) { // 가득 차 있던 slab을 다시 리스트에 넣는다
+        slab->prev = NULL;
+        slab->next = h->slabs[bin];
+        if (slab->next != NULL)
+            slab->next->prev = slab;
+        h->slabs[bin] = slab;
+    }
+    if (slab->nfree == slab->nslots && (slab->prev != NULL || slab->next != NULL)) {
+        if (slab->prev != NULL)
+            slab->prev->next = slab->next;
+        else
+            h->slabs[bin] = slab->next;
+        if (slab->next != NULL)
+            slab->next->prev = slab->prev;
+        release_slab(slab);
+    }
+}
+
+/*
+ * release_slab - Give an empty slab back to the page heap, or leave it
+ *     to the maintenance thread if one is running
+ */
+static void release_slab(span_t *slab)
+{
+    span_t *head;
+
+    if (__atomic_load_n(&maint_running, __ATOMIC_RELAXED)) {
+        head = __atomic_load_n(&retired, __ATOMIC_RELAXED);
+        do
+            slab->next = head;
+        while (!__atomic_compare_exchange_n(&retired, &head, slab, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        if (__atomic_add_fetch(&nretired, 1, __ATOMIC_RELAXED) == MAINT_PRESSURE)
+            pthread_cond_signal(&maint_cond);
+        return;
+    }
+    LOCK();
+    span_free(slab);
+    UNLOCK();
+}
+
+/*
+ * drain_remote - Take everything other threads freed into h's slabs
+ */
+static void drain_remote(theap_t *h)
+{
+    char *bp, *next;
+
+    bp = __atomic_exchange_n(&h->remote, NULL, __ATOMIC_ACQUIRE);
+    for (; bp != NULL; bp = next) {
+        next = NEXT_CACHED(bp);
+        slab_free(h, pagemap_get(bp), bp);
+    }
+}
+
+/*****************************************************************
+ * Page heap: spans of pages and the radix pagemap
+ ****************************************************************/
+
+/*
+ * pagemap_get - The span holding address p, or NULL. Needs no lock:
+ *     nodes are never freed, and a pointer the caller owns cannot have
+ *     its entry changed under it.
+ */
+static span_t *pagemap_get(void *p)
+{
+    size_t page = (size_t)p >> PAGE_SHIFT;
+    span_t ***mid;
+    span_t **leaf;
+
+    if ((mid = __atomic_load_n(&pm_root[(page >> (2 * PM_BITS)) & PM_MASK],
+                               __ATOMIC_ACQUIRE)) == NULL ||
+        (leaf = __atomic_load_n(&mid[(page >> PM_BITS) & PM_MASK],
+                                __ATOMIC_ACQUIRE)) == NULL)
+        return NULL;
+    return leaf[page & PM_MASK];
+}
+
+/*
+ * pagemap_set - Point every page of 'span' at it, making radix nodes
+ *     as needed. Returns -1 if a node cannot be mapped. Called with
+ *     mm_lock held.
+ */
+static int pagemap_set(span_t *span)
+{
+    size_t page = (size_t)span->start >> PAGE_SHIFT;
+    size_t end = page + span->npages;
+    span_t ***mid;
+    span_t **leaf;
+    void *node;
+
+    for (; page < end; page++) {
+        if (page >> (3 * PM_BITS))
+            return -1; // 48비트 주소 공간 밖
+        if ((mid = pm_root[page >> (2 * PM_BITS)]) == NULL) {
+            node = mmap(NULL, PM_LEN * sizeof(void *), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (node == MAP_FAILED)
+                return -1;
+            mid = node;
+            __atomic_store_n(&pm_root[page >> (2 * PM_BITS)], mid,
+                             __ATOMIC_RELEASE);
+        }
+        if ((leaf = mid[(page >> PM_BITS) & PM_MASK]) == NULL) {
+            node = mmap(NULL, PM_LEN * sizeof(void *), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (node == MAP_FAILED)
+                return -1;
+            leaf = node;
+            __atomic_store_n(&mid[(page >> PM_BITS) & PM_MASK], leaf,
+                             __ATOMIC_RELEASE);
+        }
+        leaf[page & PM_MASK] = span;
+    }
+    return 0;
+}
+
+/*
+ * pagemap_clear - Forget the pages of a segment going back to the heap
+ */
+static void pagemap_clear(span_t *span)
+{
+    size_t page = (size_t)span->start >> PAGE_SHIFT;
+    size_t end = page + span->npages;
+
+    for (; page < end; page++)
+        pm_root[page >> (2 * PM_BITS)][(page >> PM_BITS) & PM_MASK]
+            [page & PM_MASK] = NULL;
+}
+
+/*
+ * reset_spans - mm_init/mm_reset: every span is gone with the heap
+ */
+static void reset_spans(void)
+{
+    span_t *span;
+    int i, j;
+
+    for (i = 0; i < PM_LEN; i++)
+        if (pm_root[i] != NULL)
+            for (j = 0; j < PM_LEN; j++)
+                if (pm_root[i][j] != NULL)
+                    memset(pm_root[i][j], 0, PM_LEN * sizeof(span_t *));
+    spare_spans = NULL;
+    for (span = all_spans; span != NULL; span = span->all) {
+        span->next = spare_spans;
+        spare_spans = span;
+    }
+    free_spans = NULL;
+    __atomic_store_n(&retired, NULL, __ATOMIC_RELAXED);
+    nretired = 0;
+    maint_rover = NULL;
+}
+
+/*
+ * new_span_desc - A blank span descriptor from the metadata pool
+ */
+static span_t *new_span_desc(void)
+{
+    span_t *span, *chunk;
+    size_t i;
+
+    if (spare_spans == NULL) {
+        chunk = mmap(NULL, SPAN_CHUNK, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED)
+            return NULL;
+        for (i = 0; i < SPAN_CHUNK / sizeof(span_t); i++) {
+            chunk[i].all = all_spans;
+            all_spans = &chunk[i];
+            chunk[i].next = spare_spans;
+            spare_spans = &chunk[i];
+        }
+    }
+    span = spare_spans;
+    spare_spans = span->next;
+    span->next = span->prev = NULL;
+    span->owner = NULL;
+    span->size = 0;
+    return span;
+}
+
+/*
+ * span_alloc - Allocate a span of 'npages' pages: first fit over the
+ *     free spans, else a new segment from the boundary-tag heap. Called
+ *     with mm_lock held.
+ */
+static span_t *span_alloc(size_t npages)
+{
+    span_t *span, *rest;
+    size_t segpages;
+    char *seg;
+
+    for (span = free_spans; span != NULL; span = span->next)
+        if (span->npages >= npages)
+            break;
+
+    if (span == NULL) {
+        segpages = MAX(npages, SEG_PAGES);
+        if ((span = new_span_desc()) == NULL)
+            return NULL;
+        if ((seg = memalign_block(PAGE_SIZE, segpages * PAGE_SIZE)) == NULL) {
+            span->next = spare_spans;
+            spare_spans = span;
+            return NULL;
+        }
+        span->start = span->seg = seg;
+        span->npages = span->segpages = segpages;
+    }
+    else { // free 리스트에서 뺀다
+        if (span->prev != NULL)
+            span->prev->next = span->next;
+        else
+            free_spans = span->next;
+        if (span->next != NULL)
+            span->next->prev = span->prev;
+    }
+    span->in_use = 1;
+    span->next = span->prev = NULL;
+
+    // 남는 페이지는 새 free span으로 나눈다
+    if (span->npages > npages && (rest = new_span_desc()) != NULL) {
+        rest->start = span->start + npages * PAGE_SIZE;
+        rest->npages = span->npages - npages;
+        rest->seg = span->seg;
+        rest->segpages = span->segpages;
+        span->npages = npages;
+        if (pagemap_set(span) < 0) {
+            span->npages += rest->npages;
+            rest->next = spare_spans;
+            spare_spans = rest;
+            span_free(span);
+            return NULL;
+        }
+        span_free(rest);
+    }
+    if (pagemap_set(span) < 0) {
+        span_free(span);
+        return NULL;
+    }
+    return span;
+}
+
+/*
+ * span_free - Return a span to the page heap, merging it with the free
+ *     spans on either side in the same segment. Called with mm_lock held.
+ */
+static void span_free(span_t *span)
+{
+    span_t *nb;
+    int i;
+
+    span->in_use = 0;
+    span->size = 0;
+    span->owner = NULL;
+    for (i = 0; i < 2; i++) {
+        if (i == 0 && span->start == span->seg)
+            continue;
+        if (i == 1 && span->start + span->npages * PAGE_SIZE ==
+            span->seg + span->segpages * PAGE_SIZE)
+            continue;
+        nb = pagemap_get(i == 0 ? span->start - PAGE_SIZE
+                                : span->start + span->npages * PAGE_SIZE);
+        if (nb == NULL || nb->in_use)
+            continue;
+        if (nb->prev != NULL)
+            nb->prev->next = nb->next;
+        else
+            free_spans = nb->next;
+        if (nb->next != NULL)
+            nb->next->prev = nb->prev;
+        if (i == 0)
+            span->start = nb->start;
+        span->npages += nb->npages;
+        nb->next = spare_spans;
+        spare_spans = nb;
+    }
+
+    // 세그먼트 전체가 비면 boundary-tag 힙으로 돌려준다
+    if (span->npages == span->segpages) {
+        pagemap_clear(span);
+        free_block(&main_arena, span->seg);
+        span->next = spare_spans;
+        spare_spans = span;
+        return;
+    }
+    pagemap_set(span);
+    span->prev = NULL;
+    span->next = free_spans;
+    if (free_spans != NULL)
+        free_spans->prev = span;
+    free_spans = span;
+}
+
+/*
+ * mm_usable_size - Bytes usable at 'ptr', found from the pagemap for
+ *     slots and from the boundary tag for everything else
+ */
+size_t mm_usable_size(void *ptr)
+{
+    span_t *span;
+
+    if (ptr == NULL)
+        return 0;
+    if ((span = pagemap_get(ptr)) != NULL)
+        return span->size;
+    return GET_SIZE(HDRP(ptr)) - DSIZE;
+}
+
+/*
+ * mm_try_expand - Grow the block at 'ptr' in place towards 'max' usable
+ *     bytes, taking in the free block after it and, at the end of the
+ *     heap, fresh heap. Returns the new usable size, which is at least
+ *     'min', or 0 if the block cannot reach 'min' without moving, in
+ *     which case it is left as it was. Slots never grow.
+ */
+size_t mm_try_expand(void *ptr, size_t min, size_t max)
+{
+    span_t *span;
+    size_t n;
+
+    if (ptr == NULL)
+        return 0;
+    if ((span = pagemap_get(ptr)) != NULL)
+        return span->size >= min ? span->size : 0;
+    LOCK();
+    n = expand_block(&main_arena, ptr, min, max);
+    UNLOCK();
+    return n;
+}
+
+static size_t expand_block(arena_t *a, void *bp, size_t min, size_t max)
+{
+    size_t size = GET_SIZE(HDRP(bp)), need, want, avail;
+    int region = GET_REGION(HDRP(bp)), r;
+    char *next, *end;
+
+    if (min > MAX_BLOCK - 2 * DSIZE)
+        return 0;
+    max = MIN(MAX(min, max), MAX_BLOCK - 2 * DSIZE);
+    need = ASIZE(min);
+    want = ASIZE(max);
+    if (size >= want)
+        return size - DSIZE;
+
+    // 뒤따르는 같은 region의 가용 블록까지가 제자리에서 쓸 수 있는 공간
+    avail = size;
+    next = NEXT_BLKP(bp);
+    if (!GET_ALLOC(HDRP(next)) && GET_REGION(HDRP(next)) == region &&
+        size + GET_SIZE(HDRP(next)) <= MAX_BLOCK)
+        avail += GET_SIZE(HDRP(next));
+
+    // 힙의 끝이면 모자란 만큼 힙을 늘린다 (새 가용 블록은 next와 합쳐진다)
+    end = (char *)bp + avail;
+    if (avail < need && GET_SIZE(HDRP(end)) == 0 &&
+        extend_heap(a, MAX(need - avail, CHUNKSIZE) / WSIZE, region) != NULL) {
+        next = NEXT_BLKP(bp);
+        if (size + GET_SIZE(HDRP(next)) <= MAX_BLOCK)
+            avail = size + GET_SIZE(HDRP(next));
+    }
+    if (avail < need)
+        return 0;
+
+    size = MIN(avail, want);
+    if (avail - size < 2 * DSIZE)
+        size = avail;
+    PUT(HDRP(bp), PACK_R(size, 1, region));
+    PUT(FTRP(bp), PACK_R(size, 1, region));
+    next = NEXT_BLKP(bp);
+    if (avail > size) {
+        PUT(HDRP(next), PACK_R(avail - size, 0, region));
+        PUT(FTRP(next), PACK_R(avail - size, 0, region));
+    }
+
+    // 삼켜진 블록을 가리키던 탐색 위치를 옮긴다
+    for (r = 0; r < REGIONS; r++)
+        if (a->nextp[r] > (char *)bp && a->nextp[r] < next)
+            a->nextp[r] = next;
+    if (maint_rover > (char *)bp && maint_rover < next)
+        maint_rover = next;
+    return size - DSIZE;
+}
+
+/*
+ * mm_set_cache_mode - Serve small blocks from per-thread heaps
+ *     (MM_CACHE_THREAD) or per-CPU heaps (MM_CACHE_CPU). Returns the
+ *     previous mode. Set it before mm_init or mm_reset.
+ */
+int mm_set_cache_mode(int mode)
+{
+    int old;
+
+    LOCK();
+    old = cache_mode;
+    cache_mode = (mode == MM_CACHE_CPU) ? MM_CACHE_CPU : MM_CACHE_THREAD;
+    UNLOCK();
+    return old;
+}
+
+/*
+ * mm_lock_waits - Number of times a thread found the shared heap locked
+ */
+unsigned long mm_lock_waits(void)
+{
+    return lock_waits;
+}
+
+/*
+ * mm_set_tcache_depth - Set how many freed slots each thread may cache
+ *     per size; 0 turns thread heaps off, so that every request goes to
+ *     the locked shared heap. Returns the previous depth. Set it before
+ *     mm_init or mm_reset.
+ */
+int mm_set_tcache_depth(int depth)
+{
+    int old;
+
+    LOCK();
+    old = tcache_depth;
+    tcache_depth = depth < 0 ? 0 : depth;
+    UNLOCK();
+    return old;
+}
+
+/*
+ * find_fit - function for the simple allocator described in Section 9.9.12
+ * My solution should perform a first-fit search of the impliticit free list
+ */
+
+static void *find_fit(arena_t *a, size_t asize, int region)
+{
+    // /* First-fit search*/
+    // char* bp;
+
+    // for(bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+    // {
+    //     if(!GET_ALLOC(HDRP(bp)) && (asize <= GET_SIZE(HDRP(bp))))
+    //         return bp;
+    // }
+
+    // Next-fit
+    char *bp;
+    unsigned long probes = 0, wraps; // 살펴본 블록 수 (mm_get_stats)
+    if (a->nextp[region] == NULL)
+        a->nextp[region] = a->listp;
+    a->count.searches++;
+    
+    // 현재 위치부터 끝까지 탐색
+    for (bp = a->nextp[region]; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+    {
+        probes++;
+        if (!GET_ALLOC(HDRP(bp)) && GET_REGION(HDRP(bp)) == region &&
+            (asize <= GET_SIZE(HDRP(bp))))
+        {
+            a->nextp[region] = NEXT_BLKP(bp);  // 다음 탐색을 위해 업데이트
+            a->count.probes += probes;
+            return bp;
+        }
+    }
+    
+    // 처음부터 시작점까지 탐색
+    wraps = probes;
+    for (bp = a->listp; bp < a->nextp[region]; bp = NEXT_BLKP(bp))
+    {
+        probes++;
+        if (!GET_ALLOC(HDRP(bp)) && GET_REGION(HDRP(bp)) == region &&
+            (asize <= GET_SIZE(HDRP(bp))))
+        {
+            a->nextp[region] = NEXT_BLKP(bp);  // 다음 탐색을 위해 업데이트
+            a->count.probes += probes;
+            a->count.wraps += probes - wraps;
+            return bp;
+        }
+    }
+
+    a->count.probes += probes;
+    a->count.wraps += probes - wraps;
+    return NULL;
+
+    // // Best-fit
+    // char *bp, *min_bp = NULL;
+    // size_t min_size = SIZE_MAX;
+
+    // for(bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+    // {
+    //     if (GET_SIZE(HDRP(bp)) < min_size && !GET_ALLOC(HDRP(bp)) && (asize <= GET_SIZE(HDRP(bp))))
+    //     {
+    //         min_size = GET_SIZE(HDRP(bp));
+    //         min_bp = bp;
+    //     }
+    // }
+    // return min_bp;
+}
+
+/*
+ * place - My function should place the reqeusted block at the beginning of the free block,
+ * splitting only if the size of the remainder would equal or exceed the minimum block size
+ * 
+ */
+
+static void place(arena_t *a, void *bp, size_t asize)
+{
+    size_t fsize = GET_SIZE(HDRP(bp));
+    int region = GET_REGION(HDRP(bp));
+
+    if((fsize - asize) >= (2 * DSIZE)) {
+        PUT(HDRP(bp), PACK_R(asize, 1, region));
+        PUT(FTRP(bp), PACK_R(asize, 1, region));
+        bp = NEXT_BLKP(bp);
+        PUT(HDRP(bp), PACK_R(fsize - asize, 0, region));
+        PUT(FTRP(bp), PACK_R(fsize - asize, 0, region));
+    } else {
+        PUT(HDRP(bp), PACK_R(fsize, 1, region));
+        PUT(FTRP(bp), PACK_R(fsize, 1, region));
+    }
+    a->nextp[region] = bp;
+}
+
+/*
+ * mm_realloc - 기존에 할당된 메모리 블록의 사이즈 변경
+ * 새로 할당 받은 메모리 블록에는 기존 메모리 블록의 데이터가 복사되어 들어가야 함
+ */
+void *mm_realloc(void *bp, size_t size)
+{
+    void *old_bp = bp;
+    void *new_bp = bp;
+    size_t copy_size;
+    int region;
+
+    // size가 0인 경우 메모리 반환만 수행
+    if (size <= 0)
+    {
+        mm_free(bp);
+        return 0;
+    }
+
+    // 새로운 메모리 블록 할당하기 (기존 블록과 같은 region, slot은 헤더가 없다)
+    region = pagemap_get(old_bp) != NULL ? MM_LIFE_ANY : GET_REGION(HDRP(old_bp));
+    new_bp = mm_malloc_class(size, region);
+    if (new_bp == NULL)
+        return NULL;
+
+    // 기존 데이터 복사
+    copy_size = mm_usable_size(old_bp);
+    if (size < copy_size)
+        copy_size = size;
+    memcpy(new_bp, old_bp, copy_size);
+
+    // 이전 메모리 블록 해제
+    mm_free(old_bp);
+
+    return new_bp;
+}
+
+/*
+ * mm_search_probes - Blocks find_fit has looked at in the default heap
+ *     since mm_init or mm_reset, and in '*wraps' (if not NULL) how many
+ *     of them were after the rover wrapped around to the start. Cheap
+ *     enough to read around every request to measure its search.
+ */
+unsigned long mm_search_probes(unsigned long *wraps)
+{
+    unsigned long probes;
+
+    LOCK();
+    probes = main_arena.count.probes;
+    if (wraps != NULL)
+        *wraps = main_arena.count.wraps;
+    UNLOCK();
+    return probes;
+}
+
+/*
+ * mm_get_stats - Fill in 'stats' for the default heap: the shape of
+ *     its free blocks, from a walk over the heap, and the find_fit and
+ *     coalesce counters since the last mm_init or mm_reset. Spans, runs
+ *     and the slots in them count as allocated blocks.
+ */
+void mm_get_stats(struct mm_stats *stats)
+{
+    LOCK();
+    arena_stats(&main_arena, stats);
+    UNLOCK();
+}
+
+/*
+ * arena_stats - Walk the blocks of arena 'a' into 'stats'. Called with
+ *     the arena's lock held.
+ */
+static void arena_stats(arena_t *a, struct mm_stats *stats)
+{
+    char *bp;
+    size_t size, s;
+    int bin;
+
+    memset(stats, 0, sizeof(*stats));
+    if (a->listp == NULL)
+        return;
+    stats->heapsize = mem_heapsize_h(a->mem);
+    stats->searches = a->count.searches;
+    stats->probes = a->count.probes;
+    stats->wraps = a->count.wraps;
+    memcpy(stats->coalesce, a->count.cases, sizeof(stats->coalesce));
+
+    for (bp = NEXT_BLKP(a->listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        size = GET_SIZE(HDRP(bp));
+        if (GET_ALLOC(HDRP(bp))) {
+            stats->allocated += size;
+            continue;
+        }
+        stats->free += size;
+        stats->free_blocks++;
+        stats->largest_free = MAX(stats->largest_free, size - DSIZE);
+        // 2의 거듭제곱 구간: bin 0 = 16..31 바이트
+        for (bin = 0, s = size >> 5; s > 0 && bin < MM_STATS_BINS - 1; s >>= 1)
+            bin++;
+        stats->free_hist[bin]++;
+    }
+}
+
+
+/*****************************************************************
+ * Heap instances. Each mm_heap_create heap is an arena of its own in
+ * a memlib heap of its own, with its own lock and statistics, so
+ * subsystems do not fragment each other and can be measured apart.
+ * The descriptor sits at the start of the memlib heap, in front of
+ * the prologue, and goes away with it in mm_heap_destroy.
+ *
+ * mm_heap_open puts the heap in a file. Boundary tags hold sizes, not
+ * addresses, so the blocks survive being mapped somewhere else; the
+ * few pointers in the descriptor are rebased when the heap is opened
+ * again. Applications link their objects with mm_heap_offset and find
+ * them again from mm_heap_root.
+ *
+ * mm_heap_create_shared puts the heap in shared memory, with a lock
+ * that works across processes: processes forked from the creator
+ * allocate and free in it concurrently, and pass each other offsets
+ * (or pointers, as the heap is at the same address in all of them)
+ * instead of copying the blocks.
+ ****************************************************************/
+
+#define HEAP_MAGIC 0x6d6d686561703032UL /* "mmheap02" */
+
+struct mm_heap {
+    unsigned long magic;
+    arena_t arena;
+    pthread_mutex_t lock;
+    mm_heap_stats_t stats;
+    char *base;             /* where the heap was mapped when last opened */
+    void *root;             /* entry point for mm_heap_root, or NULL */
+    int shared;             /* in shared memory, locked across processes */
+};
+
+static mm_heap_t *format_heap(mem_heap_t *mem, int pshared);
+static mm_heap_t *attach_heap(mem_heap_t *mem);
+
+/*
+ * mm_heap_create - Make an empty heap that can grow to 'max_size'
+ *     bytes. Returns NULL if memlib cannot reserve it.
+ */
+mm_heap_t *mm_heap_create(size_t max_size)
+{
+    mem_heap_t *mem;
+
+    if ((mem = mem_create(max_size)) == NULL)
+        return NULL;
+    return format_heap(mem, 0);
+}
+
+/*
+ * mm_heap_create_shared - Make an empty heap of up to 'max_size' bytes
+ *     that is shared with the processes forked after this call.
+ *     Returns NULL if the shared memory cannot be mapped.
+ */
+mm_heap_t *mm_heap_create_shared(size_t max_size)
+{
+    mem_heap_t *mem;
+
+    if ((mem = mem_create_shared(max_size)) == NULL)
+        return NULL;
+    return format_heap(mem, 1);
+}
+
+/*
+ * mm_heap_open - Open the heap kept in file 'path', with everything
+ *     that was allocated in it when it was closed, or make an empty one
+ *     of up to 'max_size' bytes there. A heap that was not closed with
+ *     mm_heap_destroy comes back empty. Returns NULL if the file cannot
+ *     be mapped or does not hold a heap.
+ */
+mm_heap_t *mm_heap_open(const char *path, size_t max_size)
+{
+    mem_heap_t *mem;
+
+    if ((mem = mem_open(path, max_size)) == NULL)
+        return NULL;
+    if (mem_heapsize_h(mem) == 0)
+        return format_heap(mem, 0);
+    return attach_heap(mem);
+}
+
+/*
+ * format_heap - Lay out the descriptor and an empty arena in 'mem',
+ *     with a process-shared lock if 'pshared' is set
+ */
+static mm_heap_t *format_heap(mem_heap_t *mem, int pshared)
+{
+    pthread_mutexattr_t attr;
+    mm_heap_t *h;
+
+    if ((h = mem_sbrk_h(mem, ALIGN(sizeof(mm_heap_t)))) == (void *)-1) {
+        mem_destroy(mem);
+        return NULL;
+    }
+    memset(h, 0, sizeof(mm_heap_t));
+    h->magic = HEAP_MAGIC;
+    h->arena.mem = mem;
+    h->base = (char *)h;
+    h->shared = pshared;
+    pthread_mutexattr_init(&attr);
+    if (pshared)
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&h->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (format_arena(&h->arena) < 0) {
+        pthread_mutex_destroy(&h->lock);
+        mem_destroy(mem);
+        return NULL;
+    }
+    return h;
+}
+
+/*
+ * attach_heap - Take over the heap that 'mem' was closed with, moving
+ *     the pointers in its descriptor to where it is mapped now
+ */
+static mm_heap_t *attach_heap(mem_heap_t *mem)
+{
+    mm_heap_t *h = mem_heap_lo_h(mem);
+    ptrdiff_t delta;
+    int r;
+
+    if (mem_heapsize_h(mem) < ALIGN(sizeof(mm_heap_t)) + 4 * WSIZE ||
+        h->magic != HEAP_MAGIC) {
+        mem_destroy(mem);
+        errno = EINVAL;
+        return NULL;
+    }
+    delta = (char *)h - h->base;
+    h->arena.mem = mem;
+    h->arena.listp += delta;
+    for (r = 0; r < REGIONS; r++)
+        if (h->arena.nextp[r] != NULL)
+            h->arena.nextp[r] += delta;
+    if (h->root != NULL)
+        h->root = (char *)h->root + delta;
+    h->base = (char *)h;
+    pthread_mutex_init(&h->lock, NULL);
+    return h;
+}
+
+/*
+ * mm_heap_destroy - Release a heap and every block in it at once. A
+ *     heap from mm_heap_open is closed instead, blocks and all, to be
+ *     opened again later. A shared heap is only unmapped from the
+ *     calling process; the others keep using it.
+ */
+void mm_heap_destroy(mm_heap_t *h)
+{
+    if (h == NULL)
+        return;
+    if (!h->shared)
+        pthread_mutex_destroy(&h->lock);
+    mem_destroy(h->arena.mem);
+}
+
+/*
+ * mm_heap_set_root, mm_heap_root - The block an application keeps the
+ *     rest of its data reachable from, saved with the heap
+ */
+void mm_heap_set_root(mm_heap_t *h, void *bp)
+{
+    h->root = bp;
+}
+
+void *mm_heap_root(mm_heap_t *h)
+{
+    return h->root;
+}
+
+/*
+ * mm_heap_offset, mm_heap_at - Convert between a pointer into heap 'h'
+ *     and its offset from the start of the heap. Offsets stay valid
+ *     when the heap is mapped at another address.
+ */
+size_t mm_heap_offset(mm_heap_t *h, void *bp)
+{
+    return (char *)bp - (char *)h;
+}
+
+void *mm_heap_at(mm_heap_t *h, size_t offset)
+{
+    return (char *)h + offset;
+}
+
+/*
+ * mm_heap_malloc - Allocate a block from heap 'h'
+ */
+void *mm_heap_malloc(mm_heap_t *h, size_t size)
+{
+    void *bp;
+
+    pthread_mutex_lock(&h->lock);
+    if ((bp = malloc_region(&h->arena, size, MM_LIFE_ANY)) != NULL) {
+        h->stats.mallocs++;
+        h->stats.allocated += GET_SIZE(HDRP(bp));
+        if (h->stats.allocated > h->stats.peak)
+            h->stats.peak = h->stats.allocated;
+    }
+    pthread_mutex_unlock(&h->lock);
+    return bp;
+}
+
+/*
+ * mm_heap_free - Free a block that came from mm_heap_malloc on 'h'
+ */
+void mm_heap_free(mm_heap_t *h, void *bp)
+{
+    if (bp == NULL)
+        return;
+    pthread_mutex_lock(&h->lock);
+    h->stats.frees++;
+    h->stats.allocated -= GET_SIZE(HDRP(bp));
+    free_block(&h->arena, bp);
+    pthread_mutex_unlock(&h->lock);
+}
+
+/*
+ * mm_heap_stats - Copy the counters of heap 'h' into 'stats', with its
+ *     current size and the largest free block filled in
+ */
+void mm_heap_stats(mm_heap_t *h, mm_heap_stats_t *stats)
+{
+    struct mm_stats shape;
+
+    pthread_mutex_lock(&h->lock);
+    *stats = h->stats;
+    arena_stats(&h->arena, &shape);
+    stats->heapsize = shape.heapsize;
+    stats->largest_free = shape.largest_free;
+    pthread_mutex_unlock(&h->lock);
+}
+
+
+/*****************************************************************
+ * Cache-line allocation class. Objects are rounded up to whole
+ * cache lines and aligned to them, so two objects never share a
+ * line. Small ones are packed into runs to avoid one boundary tag
+ * and one alignment gap per object.
+ ****************************************************************/
+
+/*
+ * mm_malloc_cacheline - Allocate 'size' bytes rounded up to whole
+ *     CACHELINE-byte lines and aligned to a line. Free the result with
+ *     mm_free_cacheline.
+ */
+void *mm_malloc_cacheline(size_t size)
+{
+    size_t lines = (size + CACHELINE - 1) / CACHELINE;
+    span_t *span;
+    run_t *run;
+    unsigned slot;
+    void *bp;
+
+    if (size <= 0)
+        return NULL;
+    LOCK();
+    if (lines > RUN_LINES) {
+        bp = memalign_block(CACHELINE, lines * CACHELINE);
+        UNLOCK();
+        return bp;
+    }
+
+    // 빈 slot이 있는 run이 없으면 새 run을 만든다
+    if ((run = runs[lines]) == NULL) {
+        if ((span = span_alloc(RUN_SIZE / PAGE_SIZE)) == NULL) {
+            UNLOCK();
+            return NULL;
+        }
+        run = (run_t *)span->start;
+        run->lines = lines;
+        run->nslots = (RUN_SIZE - CACHELINE) / (lines * CACHELINE);
+        run->nfree = run->nslots;
+        run->used = 0;
+        run->prev = NULL;
+        run->next = NULL;
+        runs[lines] = run;
+    }
+
+    slot = __builtin_ctzl(~run->used);
+    run->used |= 1UL << slot;
+    if (--run->nfree == 0) { // 가득 찬 run은 리스트에서 뺀다
+        runs[lines] = run->next;
+        if (run->next != NULL)
+            run->next->prev = NULL;
+    }
+    UNLOCK();
+    return (char *)run + CACHELINE + slot * lines * CACHELINE;
+}
+
+/*
+ * mm_free_cacheline - Free a block returned by mm_malloc_cacheline.
+ *     A run whose slots are all free goes back to the heap, unless it
+ *     is the only run left for its size.
+ */
+void mm_free_cacheline(void *ptr)
+{
+    span_t *span = pagemap_get(ptr);
+    run_t *run = RUNP(ptr);
+    unsigned slot;
+
+    LOCK();
+    // run에 속하지 않는 큰 블록은 바로 반환
+    if (span == NULL) {
+        free_block(&main_arena, ptr);
+        UNLOCK();
+        return;
+    }
+
+    slot = ((char *)ptr - (char *)run - CACHELINE) / (run->lines * CACHELINE);
+    run->used &= ~(1UL << slot);
+
+    if (run->nfree++ == 0) { // 가득 차 있던 run을 다시 리스트에 넣는다
+        run->prev = NULL;
+        run->next = runs[run->lines];
+        if (run->next != NULL)
+            run->next->prev = run;
+        runs[run->lines] = run;
+    }
+    if (run->nfree == run->nslots && (run->prev != NULL || run->next != NULL)) {
+        if (run->prev != NULL)
+            run->prev->next = run->next;
+        else
+            runs[run->lines] = run->next;
+        if (run->next != NULL)
+            run->next->prev = run->prev;
+        span_free(span);
+    }
+    UNLOCK();
+}
+
+
+/*****************************************************************
+ * Trimming and background maintenance
+ ****************************************************************/
+
+/*
+ * mm_trim - Give the free tail of the heap back through memlib, keeping
+ *     'pad' bytes of it. Returns the number of bytes released.
+ */
+size_t mm_trim(size_t pad)
+{
+    size_t n;
+
+    LOCK();
+    n = trim_heap(pad);
+    UNLOCK();
+    return n;
+}
+
+static size_t trim_heap(size_t pad)
+{
+    char *end, *bp;
+    size_t size, newsize, decr;
+    int region, r;
+
+    // mem_reset_brk()로 비워진 힙은 건드리지 않는다
+    if (main_arena.listp == NULL ||
+        main_arena.listp != (char *)mem_heap_lo() + 2 * WSIZE)
+        return 0;
+    end = (char *)mem_heap_hi() + 1;
+    if (GET_ALLOC(end - DSIZE)) // 마지막 블록의 footer
+        return 0;
+    size = GET_SIZE(end - DSIZE);
+    region = GET_REGION(end - DSIZE);
+    bp = end - size;
+    newsize = MAX(ALIGN(pad), 2 * DSIZE);
+    if (size < newsize + PAGE_SIZE)
+        return 0;
+    decr = (size - newsize) & ~(size_t)(PAGE_SIZE - 1);
+    newsize = size - decr;
+
+    PUT(HDRP(bp), PACK_R(newsize, 0, region));
+    PUT(FTRP(bp), PACK_R(newsize, 0, region));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); // 새 epilogue
+    if (mem_trim(decr) < 0) {
+        PUT(HDRP(bp), PACK_R(size, 0, region));
+        PUT(FTRP(bp), PACK_R(size, 0, region));
+        PUT(end - WSIZE, PACK(0, 1));
+        return 0;
+    }
+
+    // 잘려 나간 곳을 가리키는 탐색 위치를 되돌린다
+    for (r = 0; r < REGIONS; r++)
+        if (main_arena.nextp[r] > (char *)bp)
+            main_arena.nextp[r] = bp;
+    if (maint_rover > (char *)bp)
+        maint_rover = NULL;
+    return decr;
+}
+
+/*
+ * mm_start_maintenance - Start the background maintenance thread, which
+ *     wakes every 'period_ms' milliseconds. Stop it with
+ *     mm_stop_maintenance before resetting the heap with mem_reset_brk.
+ *     Returns 0, or -1 if the thread cannot be created.
+ */
+int mm_start_maintenance(int period_ms)
+{
+    if (maint_running)
+        return 0;
+    maint_period = period_ms > 0 ? period_ms : 1;
+    __atomic_store_n(&maint_running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&maint_tid, NULL, maint_thread, NULL) != 0) {
+        maint_running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * mm_stop_maintenance - Stop the maintenance thread and finish its work
+ *     inline
+ */
+void mm_stop_maintenance(void)
+{
+    if (!maint_running)
+        return;
+    pthread_mutex_lock(&maint_mutex);
+    __atomic_store_n(&maint_running, 0, __ATOMIC_RELEASE);
+    pthread_cond_signal(&maint_cond);
+    pthread_mutex_unlock(&maint_mutex);
+    pthread_join(maint_tid, NULL);
+    maintain(); // 남은 retired slab 정리
+}
+
+/*
+ * maint_thread - Body of the maintenance thread: run maintain() every
+ *     maint_period milliseconds, or as soon as it is signalled, until
+ *     mm_stop_maintenance clears maint_running
+ */
+static void *maint_thread(void *vargp)
+{
+    struct timespec ts;
+
+    (void)vargp;
+    pthread_mutex_lock(&maint_mutex);
+    while (__atomic_load_n(&maint_running, __ATOMIC_ACQUIRE)) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += (long)maint_period * 1000000;
+        ts.tv_sec += ts.tv_nsec / 1000000000;
+        ts.tv_nsec %= 1000000000;
+        pthread_cond_timedwait(&maint_cond, &maint_mutex, &ts);
+        if (!maint_running)
+            break;
+        pthread_mutex_unlock(&maint_mutex);
+        maintain();
+        pthread_mutex_lock(&maint_mutex);
+    }
+    pthread_mutex_unlock(&maint_mutex);
+    return NULL;
+}
+
+/*
+ * maintain - One round of deferred work, in short lock holds
+ */
+static void maintain(void)
+{
+    span_t *span, *next;
+    unsigned long gen;
+    theap_t *h;
+    int i, n;
+
+    // 1. retired slab을 page heap으로
+    LOCK();
+    span = __atomic_exchange_n(&retired, NULL, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&nretired, 0, __ATOMIC_RELAXED);
+    gen = heap_gen;
+    UNLOCK();
+    while (span != NULL) {
+        LOCK();
+        for (n = 0; span != NULL && n < MAINT_STEP; n++, span = next) {
+            next = span->next;
+            if (heap_gen == gen)
+                span_free(span);
+        }
+        UNLOCK();
+    }
+
+    // 2. 쉬고 있는 스레드 힙의 빈 slab을 거둔다
+    for (i = 0; i < MAX_THEAPS; i++) {
+        h = &theaps[i];
+        if (cache_mode == MM_CACHE_CPU) {
+            if (__atomic_exchange_n(&h->lock, 1, __ATOMIC_ACQUIRE))
+                continue;
+            if (h->gen == __atomic_load_n(&heap_gen, __ATOMIC_ACQUIRE))
+                reclaim_theap(h);
+            __atomic_store_n(&h->lock, 0, __ATOMIC_RELEASE);
+        }
+        else if (!__atomic_load_n(&h->in_use, __ATOMIC_RELAXED) &&
+                 !__atomic_exchange_n(&h->in_use, 1, __ATOMIC_ACQUIRE)) {
+            if (h->gen == __atomic_load_n(&heap_gen, __ATOMIC_ACQUIRE))
+                reclaim_theap(h);
+            __atomic_store_n(&h->in_use, 0, __ATOMIC_RELEASE);
+        }
+    }
+
+    // 3. 힙 끝의 가용 블록을 memlib에 돌려준다
+    mm_trim(TRIM_PAD);
+
+    // 4. 큰 가용 블록의 페이지를 purge
+    for (i = 0; i < MAINT_WALK; i++) {
+        LOCK();
+        if (main_arena.listp == NULL ||
+            main_arena.listp != (char *)mem_heap_lo() + 2 * WSIZE) {
+            UNLOCK();
+            break;
+        }
+        if (maint_rover == NULL)
+            maint_rover = main_arena.listp;
+        for (n = 0; n < MAINT_STEP && GET_SIZE(HDRP(maint_rover)) > 0; n++) {
+            if (!GET_ALLOC(HDRP(maint_rover)) &&
+                GET_SIZE(HDRP(maint_rover)) >= PURGE_MIN)
+                mem_purge(maint_rover, GET_SIZE(HDRP(maint_rover)) - DSIZE);
+            maint_rover = NEXT_BLKP(maint_rover);
+        }
+        n = GET_SIZE(HDRP(maint_rover)) == 0; // epilogue에 닿았다
+        if (n)
+            maint_rover = NULL;
+        UNLOCK();
+        if (n)
+            break;
+    }
+}
+
+/*
+ * reclaim_theap - Take the remote frees of a heap nobody is using and
+ *     release its empty slabs, including the last one of each size
+ */
+static void reclaim_theap(theap_t *h)
+{
+    span_t *slab, *next;
+    int bin;
+
+    drain_remote(h);
+    for (bin = 0; bin < SMALL_BINS; bin++)
+        for (slab = h->slabs[bin]; slab != NULL; slab = next) {
+            next = slab->next;
+            if (slab->nfree != slab->nslots)
+                continue;
+            if (slab->prev != NULL)
+                slab->prev->next = slab->next;
+            else
+                h->slabs[bin] = slab->next;
+            if (slab->next != NULL)
+                slab->next->prev = slab->prev;
+            release_slab(slab);
+        }
+}
@@ -1,9 +1,90 @@
 #include <stdio.h>
 
 extern int mm_init (void);
+extern int mm_reset (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
+extern void mm_free_sized(void *ptr, size_t size);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_memalign(size_t align, size_t size);
+extern size_t mm_usable_size(void *ptr);
+extern size_t mm_try_expand(void *ptr, size_t min, size_t max);
+
+/*
+ * Lifetime classes for mm_malloc_class. Each class allocates from its
+ * own region of the heap; plain mm_malloc uses MM_LIFE_ANY.
+ */
+#define MM_LIFE_ANY    0
+#define MM_LIFE_SHORT  1
+#define MM_LIFE_MEDIUM 2
+#define MM_LIFE_LONG   3
+
+extern void *mm_malloc_class(size_t size, int cls);
+
+/* Cache-line class: whole 64-byte lines, line aligned, never shared */
+extern void *mm_malloc_cacheline(size_t size);
+extern void mm_free_cacheline(void *ptr);
+
+/* Placement hints: prefer a free block at or after a live block */
+extern void *mm_malloc_near(void *hint, size_t size);
+extern size_t mm_set_near_window(size_t bytes);
+
+/* Thread heaps: per-thread cache depth (0 = shared heap only) */
+extern int mm_set_tcache_depth(int depth);
+#define MM_CACHE_THREAD 0 /* one heap per thread */
+#define MM_CACHE_CPU    1 /* one heap per CPU */
+extern int mm_set_cache_mode(int mode);
+extern unsigned long mm_lock_waits(void);
+
+/* Shape and search cost of the default heap (mm_get_stats) */
+#define MM_STATS_BINS 16 /* free_hist[i]: blocks of 16 << i up to 32 << i bytes */
+struct mm_stats {
+    size_t heapsize;            /* bytes taken from memlib */
+    size_t allocated;           /* bytes in allocated blocks, tags included */
+    size_t free;                /* bytes in free blocks, tags included */
+    size_t free_blocks;         /* number of free blocks */
+    size_t largest_free;        /* payload of the largest free block */
+    size_t free_hist[MM_STATS_BINS]; /* free blocks by size, last bin open */
+    unsigned long searches;     /* find_fit calls */
+    unsigned long probes;       /* blocks find_fit looked at */
+    unsigned long wraps;        /* ... after the rover wrapped around */
+    unsigned long coalesce[4];  /* coalesce calls by case: neither, next,
+                                   previous, both neighbours free */
+};
+extern void mm_get_stats(struct mm_stats *stats);
+extern unsigned long mm_search_probes(unsigned long *wraps);
+
+/* Trimming, and a background thread for deferred work */
+extern size_t mm_trim(size_t pad);
+extern int mm_start_maintenance(int period_ms);
+extern void mm_stop_maintenance(void);
+
+/* Heap instances: isolated heaps, each in a memlib heap of its own */
+typedef struct mm_heap mm_heap_t;
+typedef struct {
+    size_t heapsize;        /* bytes taken from memlib */
+    size_t allocated;       /* bytes in allocated blocks, tags included */
+    size_t peak;            /* high-water mark of allocated */
+    size_t largest_free;    /* payload of the largest free block */
+    unsigned long mallocs;  /* successful mm_heap_malloc calls */
+    unsigned long frees;    /* mm_heap_free calls */
+} mm_heap_stats_t;
+
+extern mm_heap_t *mm_heap_create(size_t max_size);
+extern void mm_heap_destroy(mm_heap_t *h);
+extern void *mm_heap_malloc(mm_heap_t *h, size_t size);
+extern void mm_heap_free(mm_heap_t *h, void *ptr);
+extern void mm_heap_stats(mm_heap_t *h, mm_heap_stats_t *stats);
+
+/* Persistent heaps: kept in a file, reopened where they were left */
+extern mm_heap_t *mm_heap_open(const char *path, size_t max_size);
+extern void mm_heap_set_root(mm_heap_t *h, void *bp);
+extern void *mm_heap_root(mm_heap_t *h);
+extern size_t mm_heap_offset(mm_heap_t *h, void *bp);
+extern void *mm_heap_at(mm_heap_t *h, size_t offset);
+
+/* Shared heaps: one heap for the processes forked after it is made */
+extern mm_heap_t *mm_heap_create_shared(size_t max_size);
 
 /* 
  * Students work in teams of one or two.  Teams enter their team name, 
@@ -0,0 +1,363 @@
+/*
+ * mm_preload.c - malloc/free/realloc/calloc on top of mm.c, built as
+ *     libmm.so so that real programs can be run on the mm allocator:
+ *
+ *	unix> LD_PRELOAD=./libmm.so ls -l
+ *
+ * Call-site lifetime prediction: every allocation hashes a short stack
+ * of return addresses into a site. Each site learns online how many of
+ * its objects died young (within SHORT_AGE allocations). Objects from
+ * sites that are predicted short-lived go to the nursery, i.e. the
+ * MM_LIFE_SHORT region of the mm heap, so they do not fragment the
+ * chunks holding everything else.
+ *
+ * Environment:
+ *	MM_PREDICT=0	 learn, but route everything to the main region
+ *	MM_SITE_DEPTH=n	 return addresses hashed per site (1..8, default 2)
+ *	MM_STATS=1	 print footprint and prediction stats at exit
+ *	MM_RESERVE=n	 bytes of address space to reserve for the heap
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/*
+ * Every object carries a prefix in front of the pointer we hand out.
+ * The mm block starts 'offset' bytes before that pointer.
+ */
+typedef struct {
+    unsigned size;    /* requested size, for realloc and usable size */
+    unsigned site;    /* index of the allocation site in sites[] */
+    unsigned birth;   /* allocation clock when the object was born */
+    unsigned offset;  /* distance from the mm block to the user pointer */
+} prefix_t;
+
+#define PREFIX      ((unsigned)sizeof(prefix_t)) /* keeps 16-byte alignment */
+#define PREFIXP(p)  ((prefix_t *)((char *)(p) - PREFIX))
+
+/* Prediction parameters */
+#define SITES       4096  /* size of the site table (power of two) */
+#define MAX_DEPTH   8     /* deepest return-address stack we hash */
+#define SHORT_AGE   4096  /* objects freed within this many allocations are short */
+#define MIN_SAMPLES 32    /* allocations before a site is predicted at all */
+#define SHORT_PCT   90    /* percent of short deaths to predict short */
+
+/* Per-site lifetime statistics, learned online */
+typedef struct {
+    size_t key;           /* hash of the return-address stack, 0 = empty */
+    unsigned allocs;      /* objects allocated from this site */
+    unsigned shorts;      /* objects freed within SHORT_AGE allocations */
+    int predict_short;    /* current prediction for the site */
+} site_t;
+
+static site_t sites[SITES];
+static unsigned clock_now;   /* allocation clock */
+
+/* Configuration from the environment */
+static int predict = 1;
+static int site_depth = 2;
+static int print_stats = 0;
+static int stats_fd = -1;    /* private stderr: programs may close fd 2 */
+
+/* Counters for MM_STATS */
+static unsigned long n_allocs, n_nursery, n_sites;
+static size_t cur_bytes, peak_bytes;
+
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+static int initialized = 0;
+static __thread int in_backtrace = 0;
+static void *(*next_realloc)(void *, size_t); /* for blocks that are not ours */
+
+static void init(void);
+static void report(void) __attribute__((destructor));
+static size_t site_hash(void *caller) __attribute__((noinline));
+static unsigned site_lookup(size_t key);
+static void *alloc(size_t size, size_t align, size_t key);
+static void release(void *ptr);
+
+/*
+ * init - bring up memlib and mm on the first allocation. Called with
+ *     mm_lock held.
+ */
+static void init(void)
+{
+    char *s;
+
+    if ((s = getenv("MM_PREDICT")) != NULL)
+	predict = atoi(s);
+    if ((s = getenv("MM_SITE_DEPTH")) != NULL) {
+	site_depth = atoi(s);
+	if (site_depth < 1)
+	    site_depth = 1;
+	if (site_depth > MAX_DEPTH)
+	    site_depth = MAX_DEPTH;
+    }
+    if ((s = getenv("MM_STATS")) != NULL)
+	print_stats = atoi(s);
+    if (print_stats)
+	stats_fd = dup(2);
+    if ((s = getenv("MM_RESERVE")) != NULL && strtoul(s, NULL, 0) > 0)
+	mem_set_reserve(strtoul(s, NULL, 0));
+
+    mem_init();
+    if (mm_init() < 0) {
+	fprintf(stderr, "libmm: mm_init failed\n");
+	abort();
+    }
+    initialized = 1;
+}
+
+/*
+ * report - footprint and prediction summary, printed at exit with MM_STATS=1
+ */
+static void report(void)
+{
+    if (stats_fd < 0)
+	return;
+    dprintf(stats_fd, "libmm: predict=%d depth=%d heap=%lu peak_live=%lu "
+	    "allocs=%lu nursery=%lu sites=%lu\n",
+	    predict, site_depth, (unsigned long)mem_heapsize(),
+	    (unsigned long)peak_bytes, n_allocs, n_nursery, n_sites);
+}
+
+/*
+ * site_hash - hash the return addresses of the application frames that
+ *     led to this allocation. Depth 1 only needs 'caller', the return
+ *     address of the malloc entry point; deeper stacks go through
+ *     backtrace(), which may itself allocate the first time it runs, so
+ *     it is guarded against recursion.
+ */
+static size_t site_hash(void *caller)
+{
+    void *stack[MAX_DEPTH + 2];
+    size_t h = 0;
+    int i, n;
+
+    if (site_depth == 1 || in_backtrace)
+	return (size_t)caller | 1;
+
+    in_backtrace = 1;
+    n = backtrace(stack, site_depth + 2);
+    in_backtrace = 0;
+
+    /* skip site_hash and the malloc entry point themselves */
+    for (i = 2; i < n; i++)
+	h = (h ^ (size_t)stack[i]) * 0x100000001b3UL;
+    return h | 1;
+}
+
+/*
+ * site_lookup - find or insert the site for 'key' (open addressing)
+ */
+static unsigned site_lookup(size_t key)
+{
+    unsigned i = (unsigned)((key >> 4) ^ (key >> 20)) & (SITES - 1);
+    unsigned probes;
+
+    for (probes = 0; probes < SITES; probes++, i = (i + 1) & (SITES - 1)) {
+	if (sites[i].key == key)
+	    return i;
+	if (sites[i].key == 0) {
+	    sites[i].key = key;
+	    n_sites++;
+	    return i;
+	}
+    }
+    return 0; /* table full: share slot 0 */
+}
+
+/*
+ * alloc - allocate 'size' bytes aligned to 'align' for site 'key'.
+ *     Predicted short-lived objects go to the nursery region.
+ */
+static void *alloc(size_t size, size_t align, size_t key)
+{
+    char *bp, *p;
+    unsigned site, offset;
+    int cls = MM_LIFE_ANY;
+
+    if (size > 0xffffffffUL - 2 * PREFIX - align) {
+	errno = ENOMEM;
+	return NULL;
+    }
+
+    pthread_mutex_lock(&mm_lock);
+    if (!initialized)
+	init();
+
+    site = site_lookup(key);
+    if (predict && sites[site].predict_short)
+	cls = MM_LIFE_SHORT;
+
+    if (align <= PREFIX) {
+	offset = PREFIX;
+	bp = mm_malloc_class(size + PREFIX, cls);
+    }
+    else {
+	offset = align;
+	bp = mm_memalign(align, size + align);
+    }
+    if (bp == NULL) {
+	pthread_mutex_unlock(&mm_lock);
+	errno = ENOMEM;
+	return NULL;
+    }
+
+    p = bp + offset;
+    PREFIXP(p)->size = size;
+    PREFIXP(p)->site = site;
+    PREFIXP(p)->birth = clock_now++;
+    PREFIXP(p)->offset = offset;
+
+    sites[site].allocs++;
+    n_allocs++;
+    if (cls == MM_LIFE_SHORT)
+	n_nursery++;
+    cur_bytes += size;
+    if (cur_bytes > peak_bytes)
+	peak_bytes = cur_bytes;
+
+    pthread_mutex_unlock(&mm_lock);
+    return p;
+}
+
+/*
+ * release - free an object and feed its lifetime back to its site
+ */
+static void release(void *ptr)
+{
+    prefix_t *pre = PREFIXP(ptr);
+    site_t *s;
+
+    pthread_mutex_lock(&mm_lock);
+    s = &sites[pre->site];
+    if (clock_now - pre->birth < SHORT_AGE)
+	s->shorts++;
+    if (s->allocs >= MIN_SAMPLES)
+	s->predict_short = ((unsigned long)s->shorts * 100 >=
+			    (unsigned long)s->allocs * SHORT_PCT);
+    cur_bytes -= pre->size;
+    mm_free((char *)ptr - pre->offset);
+    pthread_mutex_unlock(&mm_lock);
+}
+
+/*
+ * owned - is ptr one of ours? Memory handed out before we were loaded
+ *     (e.g. by the dynamic loader) is left alone by free and passed on
+ *     to the next realloc by realloc.
+ */
+static int owned(void *ptr)
+{
+    return initialized && (char *)ptr > (char *)mem_heap_lo() &&
+	(char *)ptr <= (char *)mem_heap_hi();
+}
+
+/**********************
+ * The libc entry points
+ **********************/
+
+void *malloc(size_t size)
+{
+    return alloc(size, 0, site_hash(__builtin_return_address(0)));
+}
+
+void free(void *ptr)
+{
+    if (ptr != NULL && owned(ptr))
+	release(ptr);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    size_t bytes = nmemb * size;
+    void *p;
+
+    if (size != 0 && bytes / size != nmemb) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if ((p = alloc(bytes, 0, site_hash(__builtin_return_address(0)))) != NULL)
+	memset(p, 0, bytes);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *newp;
+    size_t oldsize;
+
+    if (ptr == NULL)
+	return alloc(size, 0, site_hash(__builtin_return_address(0)));
+    if (!owned(ptr)) {
+	/* not ours: leave it to the allocator that handed it out */
+	if (next_realloc == NULL)
+	    next_realloc = (void *(*)(void *, size_t))dlsym(RTLD_NEXT, "realloc");
+	if (next_realloc == NULL) {
+	    errno = ENOMEM;
+	    return NULL;
+	}
+	return next_realloc(ptr, size);
+    }
+    if (size == 0) {
+	free(ptr);
+	return NULL;
+    }
+    if ((newp = alloc(size, 0, site_hash(__builtin_return_address(0)))) == NULL)
+	return NULL;
+    oldsize = PREFIXP(ptr)->size;
+    memcpy(newp, ptr, oldsize < size ? oldsize : size);
+    release(ptr);
+    return newp;
+}
+
+void *memalign(size_t align, size_t size)
+{
+    if (align == 0 || (align & (align - 1)) != 0) {
+	errno = EINVAL;
+	return NULL;
+    }
+    return alloc(size, align, site_hash(__builtin_return_address(0)));
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    void *p;
+
+    if (align < sizeof(void *) || (align & (align - 1)) != 0)
+	return EINVAL;
+    if ((p = alloc(size, align, site_hash(__builtin_return_address(0)))) == NULL)
+	return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    return memalign(align, size);
+}
+
+void *valloc(size_t size)
+{
+    return alloc(size, getpagesize(), site_hash(__builtin_return_address(0)));
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = getpagesize();
+
+    return alloc((size + page - 1) & ~(page - 1), page, site_hash(__builtin_return_address(0)));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    return (ptr != NULL && owned(ptr)) ? PREFIXP(ptr)->size : 0;
+}
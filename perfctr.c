@@ -0,0 +1,149 @@
+/*
+ * perfctr.c - Count hardware events while a function f runs
+ *
+ * The events are opened with perf_event_open as one group, for the
+ * calling thread in user mode only: the first event that opens leads
+ * and the others join it, so all of them count over the same interval
+ * and ratios such as IPC are consistent. An event the CPU or the
+ * kernel does not offer (common in containers and virtual machines,
+ * or with a strict perf_event_paranoid), or that does not fit in the
+ * group, is simply skipped. If the kernel multiplexes the group with
+ * other users of the PMU, the counts are scaled up by the share of the
+ * time it ran; runs in which it never ran are left out.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perfctr.h"
+
+/* Where the events come from */
+static struct {
+    const char *name;
+    unsigned type;
+    unsigned long long config;
+} events[PC_EVENTS] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instr", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"L1d miss", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+     (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {"LLC miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"dTLB miss", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+     (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {"br miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+static int fds[PC_EVENTS] = {-1, -1, -1, -1, -1, -1};
+static int leader = -1;        /* fd of the group leader, -1 = none */
+static int order[PC_EVENTS];   /* events in the order they joined */
+static int nopen;              /* number of events in the group */
+
+/* What the leader reads with PERF_FORMAT_GROUP|TOTAL_TIME_ENABLED|RUNNING */
+typedef struct {
+    unsigned long long nr;
+    unsigned long long enabled;
+    unsigned long long running;
+    unsigned long long values[PC_EVENTS];
+} reading_t;
+
+/*
+ * perfctr_init - Open the group with every event we can get
+ */
+int perfctr_init(void)
+{
+    struct perf_event_attr attr;
+    int e;
+
+    if (leader >= 0)
+	return nopen;
+    for (e = 0; e < PC_EVENTS; e++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[e].type;
+	attr.config = events[e].config;
+	attr.disabled = (leader < 0); /* members follow the leader */
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP |
+	    PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[e] = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+	if (fds[e] < 0)
+	    continue;
+	if (leader < 0)
+	    leader = fds[e];
+	order[nopen++] = e;
+    }
+    return nopen;
+}
+
+/*
+ * perfctr_deinit - Close all counters, the leader last
+ */
+void perfctr_deinit(void)
+{
+    int e;
+
+    for (e = 0; e < PC_EVENTS; e++)
+	if (fds[e] >= 0 && fds[e] != leader)
+	    close(fds[e]);
+    if (leader >= 0)
+	close(leader);
+    for (e = 0; e < PC_EVENTS; e++)
+	fds[e] = -1;
+    leader = -1;
+    nopen = 0;
+}
+
+const char *perfctr_name(int e)
+{
+    return events[e].name;
+}
+
+int perfctr_available(int e)
+{
+    return fds[e] >= 0;
+}
+
+/*
+ * perfctr_run - Count the events of n runs of f(argp) and return their
+ *     average per run in counts[]. Only runs in which the group was on
+ *     the PMU count; if there were none, every event reads -1.
+ */
+int perfctr_run(perfctr_test_funct setup, perfctr_test_funct f, void *argp,
+		int n, double *counts)
+{
+    reading_t r;
+    ssize_t want = (3 + nopen) * sizeof(unsigned long long);
+    int e, i, valid = 0;
+
+    for (e = 0; e < PC_EVENTS; e++)
+	counts[e] = -1;
+    if (leader < 0)
+	return -1;
+    for (i = 0; i < nopen; i++)
+	counts[order[i]] = 0;
+
+    for (i = 0; i < n; i++) {
+	if (setup != NULL)
+	    setup(argp);
+	ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	f(argp);
+	ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+	if (read(leader, &r, sizeof(r)) < want || r.nr != (unsigned)nopen ||
+	    r.running == 0)
+	    continue;
+	for (e = 0; e < nopen; e++)
+	    counts[order[e]] += (double)r.values[e] * r.enabled / r.running;
+	valid++;
+    }
+
+    for (i = 0; i < nopen; i++)
+	counts[order[i]] = valid ? counts[order[i]] / valid : -1;
+    return 0;
+}
@@ -0,0 +1,35 @@
+/*
+ * perfctr.h - prototypes for the routines in perfctr.c that count
+ *     hardware events (cycles, cache and TLB misses, ...) while a test
+ *     function f runs, through Linux perf_event_open
+ */
+
+/* The test function takes a generic pointer as input */
+typedef void (*perfctr_test_funct)(void *);
+
+/* The events, in the order of the counts arrays below */
+#define PC_CYCLES       0
+#define PC_INSTRUCTIONS 1
+#define PC_L1D_MISSES   2 /* L1 data cache read misses */
+#define PC_LLC_MISSES   3 /* last-level cache misses */
+#define PC_DTLB_MISSES  4 /* data TLB read misses */
+#define PC_BRANCH_MISSES 5
+#define PC_EVENTS       6
+
+/* Open the counters. Return how many of the PC_EVENTS events this
+   machine (or container) lets us count; the others are skipped */
+int perfctr_init(void);
+
+/* Close the counters */
+void perfctr_deinit(void);
+
+/* Short name of event e, and whether it could be opened */
+const char *perfctr_name(int e);
+int perfctr_available(int e);
+
+/* Count the events of f(argp), calling setup(argp) (if not NULL)
+   before each run, outside the counted window. Store the average of n
+   runs in counts[PC_EVENTS], -1 for the events that are not available
+   or were never counted. Return 0, or -1 if no event is available */
+int perfctr_run(perfctr_test_funct setup, perfctr_test_funct f, void *argp,
+		int n, double *counts);
@@ -0,0 +1,30 @@
+#!/bin/sh
+#
+# preload-bench.sh - run real programs on libmm.so with call-site lifetime
+#     prediction off and on, and report the mm heap footprint and the
+#     wall-clock time of each run.
+#
+#     unix> make libmm.so && ./preload-bench.sh
+#
+LIB=`pwd`/libmm.so
+TMP=/tmp/preload-bench.$$
+
+run() {
+    for p in 0 1; do
+	start=`date +%s%N`
+	env MM_STATS=1 MM_PREDICT=$p LD_PRELOAD=$LIB "$@" >/dev/null 2>$TMP
+	end=`date +%s%N`
+	heap=`sed -n 's/.*heap=\([0-9]*\).*/\1/p' $TMP | sort -n | tail -1`
+	nursery=`sed -n 's/.*nursery=\([0-9]*\).*/\1/p' $TMP | sort -n | tail -1`
+	printf "%-10s predict=%d heap=%10s nursery=%8s %8.3f s\n" \
+	    "$1" $p "$heap" "$nursery" \
+	    `awk "BEGIN { print ($end - $start) / 1e9 }"`
+    done
+}
+
+run sort -R traces/realloc.rep
+run gcc -O2 -c -o /dev/null mdriver.c
+run python3 -c "d = {str(i): [i] * (i % 7) for i in range(200000)}"
+run awk '{ a[$2] = $0 } END { for (k in a) n++; print n }' traces/binary2.rep
+
+rm -f $TMP
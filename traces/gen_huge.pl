@@ -0,0 +1,75 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+#
+# gen_huge.pl - multi-gigabyte trace: large blocks separated by small
+# ones, two neighbours freed and their hole reused by one block twice as
+# big, and a realloc that has to move a large block to the top of the
+# heap. With the defaults the heap grows past 2 GB, so 32-bit byte counts
+# anywhere in the allocator or the driver overflow. Needs a heap
+# reservation to match, e.g. mdriver -H 4g -f traces/huge-bal.rep
+#
+# usage: gen_huge.pl [<file> [<blocks> [<block_mb>]]]
+#
+
+$out_filename = $ARGV[0];
+$out_filename = "huge-bal.rep" unless $out_filename;
+$num_large = $ARGV[1];
+$num_large = 10 unless $num_large;
+$large_size = $ARGV[2];
+$large_size = 240 unless $large_size;
+$large_size *= 1 << 20;
+$small_size = 64;
+
+die "block size must stay below 2 GB\n" if 2 * $large_size >= 1 << 31;
+die "need at least 4 blocks\n" if $num_large < 4;
+
+# Large block i has id i, the small block after it id num_large + i
+for ($i = 0; $i < $num_large; $i += 1) {
+    push @trace, "a $i $large_size";
+    $small = $num_large + $i;
+    push @trace, "a $small $small_size";
+    $total_block_size += $large_size + $small_size;
+}
+
+# Free blocks 1 and 2 and the small one between them, then fill the
+# coalesced hole with one block of twice the size
+$small = $num_large + 1;
+push @trace, "f 1";
+push @trace, "f $small";
+push @trace, "f 2";
+$double = 2 * $num_large;
+$double_size = 2 * $large_size;
+push @trace, "a $double $double_size";
+
+# Grow a block that is boxed in by its small neighbour
+$mid = int($num_large / 2);
+$grown = int($large_size * 5 / 4);
+push @trace, "r $mid $grown";
+$total_block_size += $grown;
+
+# Free everything that is still allocated
+for ($i = 0; $i < $num_large; $i += 1) {
+    push @trace, "f $i" unless $i == 1 || $i == 2;
+    $small = $num_large + $i;
+    push @trace, "f $small" unless $i == 1;
+}
+push @trace, "f $double";
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Calculate misc parameters
+$suggested_heap_size = $total_block_size + 100;
+$num_blocks = 2 * $num_large + 1;
+$num_ops = scalar @trace;
+
+print OUTFILE "$suggested_heap_size\n";
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+print OUTFILE "1\n";
+foreach $op (@trace) {
+    print OUTFILE "$op\n";
+}
+
+close OUTFILE;
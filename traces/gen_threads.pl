@@ -0,0 +1,73 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+#
+# gen_threads.pl - multithreaded trace: every thread allocates and frees
+# its own random-sized blocks, and a given percentage of the blocks are
+# freed by a different thread than the one that allocated them.
+#
+# usage: gen_threads.pl [<file> [<threads> [<blocks> [<max_size> [<remote_pct>]]]]]
+#
+
+$out_filename = $ARGV[0];
+$out_filename = "threads-bal.rep" unless $out_filename;
+$num_threads = $ARGV[1];
+$num_threads = 4 unless $num_threads;
+$num_blocks = $ARGV[2];
+$num_blocks = 2400 unless $num_blocks;
+$max_blk_size = $ARGV[3];
+$max_blk_size = 512 unless $max_blk_size;
+$remote_pct = $ARGV[4];
+$remote_pct = 25 unless defined $remote_pct;
+
+# Make a series of malloc()s, each one issued by a random thread
+for ($i = 0;  $i < $num_blocks; $i += 1) {
+    $size = int(rand $max_blk_size) + 1;
+    $op = {};
+    $op->{type} = "a";
+    $op->{seq} = $i;
+    $op->{size} = $size;
+    $op->{tid} = int(rand $num_threads);
+    $tid[$i] = $op->{tid};
+    $total_block_size += $size;
+    push @trace, $op;
+}
+# Insert free()s in proper places, some of them on another thread
+for ($i = 0;  $i < $num_blocks; $i += 1) {
+    for ($minval = $i; $minval < $num_blocks + $i; $minval += 1) {
+        if (($trace[$minval]->{type} eq "a") && ($trace[$minval]->{seq} == $i)) {
+            last;
+        }
+    }
+    $pos = int(rand($num_blocks + $i - $minval - 1) + $minval + 1);
+    $op = {};
+    $op->{type} = "f";
+    $op->{seq} = $i;
+    $op->{tid} = $tid[$i];
+    if ($num_threads > 1 && rand(100) < $remote_pct) {
+        $op->{tid} = ($tid[$i] + 1 + int(rand($num_threads - 1))) % $num_threads;
+    }
+    splice @trace, $pos, 0, $op;
+}
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Calculate misc parameters
+$suggested_heap_size = $total_block_size + 100;
+$num_ops = 2*$num_blocks;
+
+print OUTFILE "$suggested_heap_size\n";
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+print OUTFILE "1\n";
+
+for ($i = 0;  $i < 2*$num_blocks; $i += 1) {
+    if ($trace[$i]->{type} eq "a") {
+        print OUTFILE "$trace[$i]->{type}:$trace[$i]->{tid} $trace[$i]->{seq} $trace[$i]->{size}\n";
+    } else {
+        print OUTFILE "$trace[$i]->{type}:$trace[$i]->{tid} $trace[$i]->{seq}\n";
+    }
+}
+
+close OUTFILE;